@@ -0,0 +1,35 @@
+#ifndef __AFFINITY__
+#define __AFFINITY__
+
+/*
+ * Thread placement for the concurrent benchmarks. The topology (online
+ * CPUs grouped by NUMA node) is read from /sys/devices/system/node; if
+ * it is not available all the CPUs we may run on form a single node.
+ *  - none:    leave placement to the scheduler;
+ *  - compact: fill the CPUs of node 0 first, then node 1, ...;
+ *  - scatter: spread consecutive threads across the nodes;
+ *  - node:    bind thread i to all the CPUs of node i % nodes.
+ * Data that a thread allocates and touches first after being placed
+ * ends up on its local node (first-touch policy).
+ */
+#define PLACEMENT_NONE      0
+#define PLACEMENT_COMPACT   1
+#define PLACEMENT_SCATTER   2
+#define PLACEMENT_NODE      3
+
+int parse_placement(const char* name);
+const char* placement_name(int placement);
+
+// reads the topology, must be called before any other function below
+void placement_init();
+int online_cpus();
+int numa_nodes();
+
+/*
+ * Binds the calling thread according to placement, where index is the
+ * position of the thread in the benchmark (0, 1, ...). Returns the CPU
+ * (or, for PLACEMENT_NODE, the node) it was bound to, -1 if unbound.
+ */
+int place_thread(int placement, int index);
+
+#endif
@@ -0,0 +1,162 @@
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+static const char* pattern_names[NUM_PATTERNS] = { "sequential", "strided", "chase" };
+static const char* op_names[NUM_OPS] = { "read", "write", "rmw" };
+
+int parse_pattern(const char* name) {
+	int i;
+	for (i = 0; i < NUM_PATTERNS; i++)
+		if (strcmp(name, pattern_names[i]) == 0) return i;
+	return -1;
+}
+
+const char* pattern_name(int pattern) {
+	return pattern_names[pattern];
+}
+
+int parse_op(const char* name) {
+	int i;
+	for (i = 0; i < NUM_OPS; i++)
+		if (strcmp(name, op_names[i]) == 0) return i;
+	return -1;
+}
+
+const char* op_name(int op) {
+	return op_names[op];
+}
+
+// xorshift64*, good enough to shuffle the chase
+static unsigned long long next_random(unsigned long long* state) {
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+/*
+ * Sattolo's shuffle gives a single cycle through all the lines, so the
+ * chase visits every one of them before coming back to the first.
+ */
+static int build_chase(workload* w) {
+	size_t lines = w->items / LINE_LONGS, i;
+	size_t* order = (size_t*)malloc(lines * sizeof(size_t));
+	if (order == NULL) return -1;
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	for (i = 0; i < lines; i++)
+		order[i] = i;
+	for (i = lines - 1; i > 0; i--) {
+		size_t j = next_random(&state) % i;
+		size_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < lines; i++)
+		w->buff[order[i] * LINE_LONGS] = order[(i + 1) % lines] * LINE_LONGS;
+	free(order);
+	return 0;
+}
+
+int workload_init(workload* w, size_t bytes, int pattern, int op, size_t stride, size_t prefetch) {
+	w->items = bytes / sizeof(long);
+	if (w->items < 2 * LINE_LONGS) w->items = 2 * LINE_LONGS;
+	w->items -= w->items % LINE_LONGS;
+	w->pattern = pattern;
+	w->op = op;
+	w->stride = (stride > 0) ? stride : 1;
+	w->prefetch = prefetch;
+
+	// private anonymous memory: it is copied on write after a fork()
+	void* buff = mmap(NULL, w->items * sizeof(long), PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buff == MAP_FAILED) return -1;
+	w->buff = (long*)buff;
+
+	size_t i;
+	for (i = 0; i < w->items; i++)
+		w->buff[i] = (long)i;
+	if (pattern == PATTERN_CHASE && build_chase(w)) {
+		munmap(w->buff, w->items * sizeof(long));
+		return -1;
+	}
+	return 0;
+}
+
+size_t workload_accesses(workload* w) {
+	return (w->pattern == PATTERN_CHASE) ? w->items / LINE_LONGS : w->items;
+}
+
+/*
+ * The access itself: op is a compile-time constant in every caller
+ * below, so each kernel gets its own loop without a switch inside.
+ */
+#define ACCESS(p, op, sum) do {                     \
+		if ((op) == OP_READ) (sum) += *(p);         \
+		else if ((op) == OP_WRITE) *(p) = (sum);    \
+		else (sum) += ++*(p);                       \
+	} while (0)
+
+static inline long linear(workload* w, size_t sweeps, int op) {
+	long* buff = w->buff;
+	size_t items = w->items, stride = w->stride, distance = w->prefetch * stride;
+	long sum = 0;
+	size_t s, start, i;
+	for (s = 0; s < sweeps; s++) {
+		for (start = 0; start < stride; start++) {
+			if (distance == 0) {
+				for (i = start; i < items; i += stride)
+					ACCESS(&buff[i], op, sum);
+			} else {
+				for (i = start; i < items; i += stride) {
+					// the rw argument must be a literal even at -O0
+					if (i + distance < items) {
+						if (op == OP_READ) __builtin_prefetch(&buff[i + distance], 0);
+						else __builtin_prefetch(&buff[i + distance], 1);
+					}
+					ACCESS(&buff[i], op, sum);
+				}
+			}
+		}
+	}
+	return sum;
+}
+
+// the next index is at the start of each line, the access in the second long
+static inline long chase(workload* w, size_t sweeps, int op) {
+	long* buff = w->buff;
+	size_t steps = sweeps * (w->items / LINE_LONGS), i;
+	long sum = 0, next = 0;
+	for (i = 0; i < steps; i++) {
+		ACCESS(&buff[next + 1], op, sum);
+		next = buff[next];
+	}
+	return sum + next;
+}
+
+long workload_run(workload* w, size_t sweeps) {
+	if (w->pattern == PATTERN_CHASE) {
+		switch (w->op) {
+		case OP_READ:  return chase(w, sweeps, OP_READ);
+		case OP_WRITE: return chase(w, sweeps, OP_WRITE);
+		default:       return chase(w, sweeps, OP_RMW);
+		}
+	}
+	// sequential is strided with stride 1
+	size_t stride = w->stride;
+	if (w->pattern == PATTERN_SEQUENTIAL) w->stride = 1;
+	long sum;
+	switch (w->op) {
+	case OP_READ:  sum = linear(w, sweeps, OP_READ); break;
+	case OP_WRITE: sum = linear(w, sweeps, OP_WRITE); break;
+	default:       sum = linear(w, sweeps, OP_RMW);
+	}
+	w->stride = stride;
+	return sum;
+}
+
+void workload_free(workload* w) {
+	munmap(w->buff, w->items * sizeof(long));
+	w->buff = NULL;
+}
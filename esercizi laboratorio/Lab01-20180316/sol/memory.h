@@ -0,0 +1,61 @@
+#ifndef __MEMORY__
+#define __MEMORY__
+
+#include <stddef.h>
+
+/*
+ * Memory access kernels, a generalization of do_work() (one write every
+ * STEP elements of a large buffer):
+ *  - sequential: every element in order;
+ *  - strided:    every element, visiting them stride elements apart
+ *                (stride passes, each one starting one element later);
+ *  - chase:      a random cyclic permutation of cache lines, each one
+ *                holding the index of the next: every load depends on
+ *                the previous one, so the time is the memory latency.
+ * Each access reads, writes or increments (read-modify-write) a long.
+ * With prefetch > 0 the sequential and strided kernels issue a software
+ * prefetch that many accesses ahead; a chase cannot know its next line
+ * in advance and ignores it.
+ */
+#define PATTERN_SEQUENTIAL  0
+#define PATTERN_STRIDED     1
+#define PATTERN_CHASE       2
+#define NUM_PATTERNS        3
+
+#define OP_READ     0
+#define OP_WRITE    1
+#define OP_RMW      2
+#define NUM_OPS     3
+
+#define LINE_LONGS  8   // longs in a 64-byte cache line
+
+typedef struct {
+	long* buff;
+	size_t items;       // longs in the buffer
+	int pattern;
+	int op;
+	size_t stride;      // in longs, for PATTERN_STRIDED
+	size_t prefetch;    // distance in accesses, 0 to disable
+} workload;
+
+int parse_pattern(const char* name);
+const char* pattern_name(int pattern);
+int parse_op(const char* name);
+const char* op_name(int op);
+
+/*
+ * Allocates a buffer of (at least) bytes and initializes it, touching
+ * every page: for the chase pattern this also builds the permutation.
+ * Returns 0 on success, -1 if the buffer cannot be allocated.
+ */
+int workload_init(workload* w, size_t bytes, int pattern, int op, size_t stride, size_t prefetch);
+
+// accesses made by one sweep over the whole buffer
+size_t workload_accesses(workload* w);
+
+// runs sweeps sweeps over the buffer, returns a checksum of the reads
+long workload_run(workload* w, size_t sweeps);
+
+void workload_free(workload* w);
+
+#endif
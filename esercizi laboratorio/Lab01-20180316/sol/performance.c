@@ -1,40 +1,237 @@
 #include "performance.h"
-#include <math.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 
-struct timespec diff(struct timespec start, struct timespec end)
-{
-	struct timespec temp;
-	if (end.tv_nsec - start.tv_nsec < 0) {
-		temp.tv_sec = end.tv_sec - start.tv_sec-1;
-		temp.tv_nsec = 1000000000 + end.tv_nsec-start.tv_nsec;
-	} else {
-		temp.tv_sec = end.tv_sec - start.tv_sec;
-		temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+static int source = TIMER_CLOCK;
+static double ns_per_tick = 1.0;
+
+static unsigned long long clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+// the lfence keeps the region from starting before rdtsc
+static inline unsigned long long tsc_begin(void) {
+	_mm_lfence();
+	unsigned long long ticks = __rdtsc();
+	_mm_lfence();
+	return ticks;
+}
+
+// rdtscp waits for the region to complete, the lfence for rdtscp
+static inline unsigned long long tsc_end(void) {
+	unsigned int aux;
+	unsigned long long ticks = __rdtscp(&aux);
+	_mm_lfence();
+	return ticks;
+}
+
+// invariant TSC: CPUID.80000007H:EDX[8], rdtscp: CPUID.80000001H:EDX[27]
+static int tsc_invariant(void) {
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) return 0;
+	__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 27))) return 0;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+
+// ticks per nanosecond over a 20 ms window, best of three
+static double tsc_calibrate(void) {
+	struct timespec pause = { 0, 20000000 };
+	double best = 0;
+	int i;
+	for (i = 0; i < 3; i++) {
+		unsigned long long ns0 = clock_ns(), t0 = tsc_begin();
+		nanosleep(&pause, NULL);
+		unsigned long long t1 = tsc_end(), ns1 = clock_ns();
+		double ratio = (double)(ns1 - ns0) / (t1 - t0);
+		if (best == 0 || ratio < best) best = ratio; // preemption only adds nanoseconds
+	}
+	return best;
+}
+#endif
+
+int timer_init(int requested) {
+	source = TIMER_CLOCK;
+#ifdef HAVE_TSC
+	if (requested == TIMER_TSC && tsc_invariant()) {
+		ns_per_tick = tsc_calibrate();
+		source = TIMER_TSC;
 	}
-	return temp;
+#endif
+	return source;
+}
+
+int timer_source(void) {
+	return source;
+}
+
+const char* timer_name(int id) {
+	return (id == TIMER_TSC) ? "tsc" : "clock";
+}
+
+int parse_timer(const char* name) {
+	if (strcmp(name, "clock") == 0) return TIMER_CLOCK;
+	if (strcmp(name, "tsc") == 0) return TIMER_TSC;
+	return -1;
 }
 
 void begin(timer* t) {
-	clock_gettime(CLOCK_MONOTONIC, &(t->begin));
+#ifdef HAVE_TSC
+	if (source == TIMER_TSC) {
+		t->begin = tsc_begin();
+		return;
+	}
+#endif
+	t->begin = clock_ns();
 }
 
 void end(timer* t) {
-	clock_gettime(CLOCK_MONOTONIC, &(t->end));
-	t->elapsed = diff(t->begin, t->end);
+#ifdef HAVE_TSC
+	if (source == TIMER_TSC) {
+		t->end = tsc_end();
+		t->elapsed = (unsigned long long)((t->end - t->begin) * ns_per_tick + 0.5);
+		return;
+	}
+#endif
+	t->end = clock_ns();
+	t->elapsed = t->end - t->begin;
+}
+
+unsigned long long get_nanoseconds(timer* t) {
+	return t->elapsed;
+}
+
+unsigned long long get_microseconds(timer* t) {
+	return (t->elapsed + 500) / 1000;
+}
+
+unsigned long long get_milliseconds(timer* t) {
+	return (t->elapsed + 500000) / 1000000;
+}
+
+unsigned long long get_seconds(timer* t) {
+	return (t->elapsed + 500000000) / 1000000000;
+}
+
+static const char* counter_names[NUM_COUNTERS] = {
+	"cycles", "instructions", "llc-misses", "dtlb-misses",
+	"minor-faults", "major-faults", "context-switches"
+};
+
+const char* counter_name(int id) {
+	return counter_names[id];
+}
+
+static int open_event(unsigned int type, unsigned long long config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.inherit = 1; // count forked children and spawned threads too
+	int fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd == -1) {
+		// with perf_event_paranoid >= 2 only user-space events are allowed
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	return fd;
+}
+
+#define CACHE_EVENT(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+int counters_open(counters* c) {
+	memset(c, 0, sizeof(counters));
+	c->fd[COUNTER_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	c->fd[COUNTER_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	c->fd[COUNTER_LLC_MISSES] = open_event(PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_LL));
+	c->fd[COUNTER_DTLB_MISSES] = open_event(PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB));
+	c->fd[COUNTER_MINOR_FAULTS] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN);
+	c->fd[COUNTER_MAJOR_FAULTS] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ);
+	c->fd[COUNTER_CONTEXT_SWITCHES] = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+
+	// software events are all or nothing: otherwise use getrusage()
+	int i;
+	for (i = COUNTER_MINOR_FAULTS; i <= COUNTER_CONTEXT_SWITCHES; i++)
+		if (c->fd[i] == -1) c->rusage = 1;
+	if (c->rusage) {
+		for (i = COUNTER_MINOR_FAULTS; i <= COUNTER_CONTEXT_SWITCHES; i++) {
+			if (c->fd[i] != -1) close(c->fd[i]);
+			c->fd[i] = -1;
+		}
+	}
+
+	int opened = 0;
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		c->delta[i] = -1;
+		if (c->fd[i] != -1) opened++;
+	}
+	return opened;
 }
 
-unsigned long int get_nanoseconds(timer* t) {
-	return t->elapsed.tv_sec * 1000000000 + t->elapsed.tv_nsec;
+static unsigned long long read_event(int fd) {
+	unsigned long long value = 0;
+	if (read(fd, &value, sizeof(value)) != sizeof(value)) return 0;
+	return value;
 }
 
-unsigned long int get_microseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000);
+// faults and context switches of this process and of its waited-for children
+static void read_rusage(unsigned long long* values) {
+	struct rusage self, children;
+	getrusage(RUSAGE_SELF, &self);
+	getrusage(RUSAGE_CHILDREN, &children);
+	values[COUNTER_MINOR_FAULTS] = self.ru_minflt + children.ru_minflt;
+	values[COUNTER_MAJOR_FAULTS] = self.ru_majflt + children.ru_majflt;
+	values[COUNTER_CONTEXT_SWITCHES] = self.ru_nvcsw + self.ru_nivcsw +
+			children.ru_nvcsw + children.ru_nivcsw;
 }
 
-unsigned long int get_milliseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000);
+void counters_begin(counters* c) {
+	int i;
+	if (c->rusage) read_rusage(c->start);
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (c->fd[i] == -1) continue;
+		ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void counters_end(counters* c) {
+	int i;
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (c->fd[i] == -1) continue;
+		ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		c->delta[i] = read_event(c->fd[i]);
+	}
+	if (c->rusage) {
+		unsigned long long now[NUM_COUNTERS];
+		read_rusage(now);
+		for (i = COUNTER_MINOR_FAULTS; i <= COUNTER_CONTEXT_SWITCHES; i++)
+			c->delta[i] = now[i] - c->start[i];
+	}
 }
 
-unsigned long int get_seconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000000);
+void counters_close(counters* c) {
+	int i;
+	for (i = 0; i < NUM_COUNTERS; i++) {
+		if (c->fd[i] != -1) close(c->fd[i]);
+		c->fd[i] = -1;
+	}
 }
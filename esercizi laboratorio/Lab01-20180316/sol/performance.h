@@ -3,17 +3,61 @@
 
 #include <time.h>       /* time */
 
+/*
+ * begin() and end() read CLOCK_MONOTONIC by default. After
+ * timer_init(TIMER_TSC) they read the time-stamp counter instead
+ * (rdtscp plus fences, no system call), converted to nanoseconds with
+ * a ratio calibrated against CLOCK_MONOTONIC: use it for sub-microsecond
+ * regions. The TSC is used only if the CPU reports it as invariant,
+ * otherwise timer_init() keeps the clock and returns TIMER_CLOCK.
+ */
+#define TIMER_CLOCK 0
+#define TIMER_TSC   1
+
 typedef struct {
-	struct timespec begin;
-	struct timespec end;
-	struct timespec elapsed;
+	unsigned long long begin;   // nanoseconds or TSC ticks
+	unsigned long long end;
+	unsigned long long elapsed; // nanoseconds
 } timer;
 
+int timer_init(int source);
+int timer_source(void);
+const char* timer_name(int source);
+int parse_timer(const char* name);
+
 void begin(timer* t);
 void end(timer* t);
-unsigned long int get_seconds(timer* t);
-unsigned long int get_milliseconds(timer* t);
-unsigned long int get_microseconds(timer* t);
-unsigned long int get_nanoseconds(timer* t);
+unsigned long long get_seconds(timer* t);
+unsigned long long get_milliseconds(timer* t);
+unsigned long long get_microseconds(timer* t);
+unsigned long long get_nanoseconds(timer* t);
+
+/*
+ * Counters sampled around a region, next to the timer: hardware events
+ * come from perf_event_open(2) and include the children forked inside
+ * the region (inherit). Page faults and context switches fall back to
+ * getrusage(2) when perf events are not permitted.
+ */
+#define COUNTER_CYCLES          0
+#define COUNTER_INSTRUCTIONS    1
+#define COUNTER_LLC_MISSES      2
+#define COUNTER_DTLB_MISSES     3
+#define COUNTER_MINOR_FAULTS    4
+#define COUNTER_MAJOR_FAULTS    5
+#define COUNTER_CONTEXT_SWITCHES 6
+#define NUM_COUNTERS            7
+
+typedef struct {
+	int fd[NUM_COUNTERS];               // -1 if the event could not be opened
+	int rusage;                         // 1 if faults/switches come from getrusage
+	unsigned long long start[NUM_COUNTERS];
+	long long delta[NUM_COUNTERS];      // -1 if not available
+} counters;
+
+int counters_open(counters* c);
+void counters_begin(counters* c);
+void counters_end(counters* c);
+void counters_close(counters* c);
+const char* counter_name(int id);
 
 #endif
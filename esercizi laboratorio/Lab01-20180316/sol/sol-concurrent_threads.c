@@ -1,7 +1,12 @@
+#include "performance.h"
+#include "affinity.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <errno.h>
+#include <unistd.h>
 
 #define N 1000 // number of threads
 #define M 10000 // number of iterations per thread
@@ -22,8 +27,57 @@
  * For questions, send an email to aniello@dis.uniroma1.it
  */
 
+/*
+ * Where each accumulator lives matters as much as having one per
+ * thread: with the packed array above eight threads share every 64-byte
+ * cache line, so each add invalidates the line in the other cores'
+ * caches (false sharing). The layout can be chosen from the command
+ * line:
+ *  - packed:  the original shared_array of unsigned long;
+ *  - padded:  one cache-line-aligned slot per thread;
+ *  - local:   a variable on the thread's own stack, merged at the end;
+ *  - atomic:  a single counter updated with atomic fetch_add;
+ *  - sharded: SHARDS cache-line-aligned atomic counters, thread i uses
+ *             shard i % SHARDS.
+ * In every layout each iteration is a real memory update (volatile or
+ * atomic), so the comparison only shows where the update lands. Use
+ * "bench" as layout to sweep all of them over 1, 2, 4, ... n threads.
+ *
+ * With -p compact|scatter|node every thread is pinned (see affinity.h)
+ * before touching its data, and in the padded layout it allocates its
+ * own slot, so that the slot lives on the thread's NUMA node. With -C
+ * the number of threads is capped at the number of online CPUs.
+ */
+
+#define CACHE_LINE_SIZE 64
+#define SHARDS 16
+
+#define LAYOUT_PACKED   0
+#define LAYOUT_PADDED   1
+#define LAYOUT_LOCAL    2
+#define LAYOUT_ATOMIC   3
+#define LAYOUT_SHARDED  4
+#define NUM_LAYOUTS     5
+
+const char* layout_names[NUM_LAYOUTS] = { "packed", "padded", "local", "atomic", "sharded" };
+
+typedef struct {
+	unsigned long int value;
+} __attribute__((aligned(CACHE_LINE_SIZE))) padded_counter;
+
+typedef struct {
+	atomic_ulong value;
+} __attribute__((aligned(CACHE_LINE_SIZE))) padded_atomic_counter;
+
 int n = N, m = M, v = V;
+int layout = LAYOUT_PACKED;
+int placement = PLACEMENT_NONE;
 unsigned long int* shared_array;
+padded_counter* padded_array;
+padded_counter** padded_slots; // padded_array + i, or allocated by thread i
+unsigned long int* local_results;
+atomic_ulong atomic_total;
+padded_atomic_counter shards[SHARDS];
 
 void* thread_work(void *arg) {
 	/*
@@ -33,51 +87,223 @@ void* thread_work(void *arg) {
 	 */
 	int thread_idx = *((int*)arg);
 	int i;
-	for (i = 0; i < m; i++)
-		shared_array[thread_idx] += v;
+	if (placement != PLACEMENT_NONE) {
+		place_thread(placement, thread_idx);
+		if (layout == LAYOUT_PADDED) {
+			// first touch from the pinned thread: local NUMA node
+			padded_counter* slot;
+			if (posix_memalign((void**)&slot, CACHE_LINE_SIZE, sizeof(padded_counter)) != 0) {
+				fprintf(stderr, "Cannot allocate memory!\n");
+				exit(EXIT_FAILURE);
+			}
+			slot->value = 0;
+			padded_slots[thread_idx] = slot;
+		}
+	}
+	switch (layout) {
+	case LAYOUT_PACKED: {
+		volatile unsigned long int* slot = &shared_array[thread_idx];
+		for (i = 0; i < m; i++)
+			*slot += v;
+		break;
+	}
+	case LAYOUT_PADDED: {
+		volatile unsigned long int* slot = &padded_slots[thread_idx]->value;
+		for (i = 0; i < m; i++)
+			*slot += v;
+		break;
+	}
+	case LAYOUT_LOCAL: {
+		volatile unsigned long int local = 0;
+		for (i = 0; i < m; i++)
+			local += v;
+		local_results[thread_idx] = local; // one shared write per thread
+		break;
+	}
+	case LAYOUT_ATOMIC:
+		for (i = 0; i < m; i++)
+			atomic_fetch_add_explicit(&atomic_total, v, memory_order_relaxed);
+		break;
+	case LAYOUT_SHARDED: {
+		atomic_ulong* shard = &shards[thread_idx % SHARDS].value;
+		for (i = 0; i < m; i++)
+			atomic_fetch_add_explicit(shard, v, memory_order_relaxed);
+		break;
+	}
+	}
 	return NULL;
 }
 
+int parse_layout(const char* name) {
+	int i;
+	for (i = 0; i < NUM_LAYOUTS; i++)
+		if (strcmp(name, layout_names[i]) == 0) return i;
+	return -1;
+}
+
+void alloc_accumulators(int threads) {
+	shared_array = (unsigned long int*)calloc(threads, sizeof(unsigned long int));
+	local_results = (unsigned long int*)calloc(threads, sizeof(unsigned long int));
+	padded_slots = (padded_counter**)malloc(threads * sizeof(padded_counter*));
+	if (posix_memalign((void**)&padded_array, CACHE_LINE_SIZE, threads * sizeof(padded_counter)) != 0 ||
+			shared_array == NULL || local_results == NULL || padded_slots == NULL) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(padded_array, 0, threads * sizeof(padded_counter));
+	atomic_store(&atomic_total, 0);
+	int i;
+	for (i = 0; i < threads; i++)
+		padded_slots[i] = &padded_array[i];
+	for (i = 0; i < SHARDS; i++)
+		atomic_store(&shards[i].value, 0);
+}
+
+void free_accumulators(int threads) {
+	int i;
+	for (i = 0; i < threads; i++)
+		if (padded_slots[i] != &padded_array[i]) free(padded_slots[i]);
+	free(padded_slots);
+	free(shared_array);
+	free(padded_array);
+	free(local_results);
+}
+
+/*
+ * Merges the accumulators of the current layout once all the threads
+ * have been joined.
+ */
+unsigned long int merge_accumulators(int threads) {
+	unsigned long int total = 0;
+	int i;
+	switch (layout) {
+	case LAYOUT_PACKED:
+		for (i = 0; i < threads; i++) total += shared_array[i];
+		break;
+	case LAYOUT_PADDED:
+		for (i = 0; i < threads; i++) total += padded_slots[i]->value;
+		break;
+	case LAYOUT_LOCAL:
+		for (i = 0; i < threads; i++) total += local_results[i];
+		break;
+	case LAYOUT_ATOMIC:
+		total = atomic_load(&atomic_total);
+		break;
+	case LAYOUT_SHARDED:
+		for (i = 0; i < SHARDS; i++) total += atomic_load(&shards[i].value);
+		break;
+	}
+	return total;
+}
+
+/*
+ * Runs threads threads with the current layout and returns the merged
+ * value; t measures the time from the first create to the last join.
+ */
+unsigned long int run(int threads, timer* t) {
+	pthread_t* handles = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	int* thread_ids = (int*)malloc(threads * sizeof(int));
+	int i;
+	alloc_accumulators(threads);
+	begin(t);
+	for (i = 0; i < threads; i++) {
+		thread_ids[i] = i;
+		if (pthread_create(&handles[i], NULL, thread_work, &thread_ids[i]) != 0) {
+			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(handles[i], NULL);
+	end(t);
+	unsigned long int total = merge_accumulators(threads);
+	free_accumulators(threads);
+	free(handles);
+	free(thread_ids);
+	return total;
+}
+
+/*
+ * Sweeps every layout over 1, 2, 4, ... n threads and prints the
+ * throughput in millions of adds per second.
+ */
+void benchmark() {
+	printf("%8s", "threads");
+	int l, threads;
+	for (l = 0; l < NUM_LAYOUTS; l++)
+		printf(" %12s", layout_names[l]);
+	printf("   (Madds/s)\n");
+
+	for (threads = 1; ; threads = (threads * 2 > n && threads < n) ? n : threads * 2) {
+		printf("%8d", threads);
+		for (l = 0; l < NUM_LAYOUTS; l++) {
+			timer t;
+			layout = l;
+			unsigned long int total = run(threads, &t);
+			if (total != (unsigned long int)threads*m*v) {
+				fprintf(stderr, "\nLayout %s lost adds with %d threads!\n", layout_names[l], threads);
+				exit(EXIT_FAILURE);
+			}
+			printf(" %12.2f", (double)threads * m / get_nanoseconds(&t) * 1e3);
+			fflush(stdout);
+		}
+		printf("\n");
+		if (threads >= n) break;
+	}
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s [-p none|compact|scatter|node] [-C] "
+			"[<n> [<m> [<v> [packed|padded|local|atomic|sharded|bench]]]]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
 int main(int argc, char **argv)
 {
+	char* prog = argv[0];
+	int cap = 0, opt;
+	while ((opt = getopt(argc, argv, "p:C")) != -1) {
+		switch (opt) {
+		case 'p':
+			placement = parse_placement(optarg);
+			if (placement < 0) usage(prog);
+			break;
+		case 'C': cap = 1; break;
+		default: usage(prog);
+		}
+	}
+	argc -= optind - 1; // positional arguments as argv[1], argv[2], ...
+	argv += optind - 1;
 	if (argc > 1) n = atoi(argv[1]);
 	if (argc > 2) m = atoi(argv[2]);
 	if (argc > 3) v = atoi(argv[3]);
-	shared_array = (unsigned long int*)calloc(n, sizeof(unsigned long int));
+	placement_init();
+	if (cap && n > online_cpus()) n = online_cpus();
+	if (argc > 4) {
+		if (strcmp(argv[4], "bench") == 0) {
+			printf("Placement %s, %d CPUs on %d NUMA nodes\n", placement_name(placement), online_cpus(), numa_nodes());
+			benchmark();
+			return EXIT_SUCCESS;
+		}
+		layout = parse_layout(argv[4]);
+		if (layout < 0) usage(prog);
+	}
 
-	printf("Going to start %d threads, each adding %d times %d to a shared data structure initialized to zero...", n, m, v); fflush(stdout);
-	pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t));
+	printf("Going to start %d threads, each adding %d times %d to a shared data structure initialized to zero (%s layout)...", n, m, v, layout_names[layout]); fflush(stdout);
 	/*
 	 * We need to tell the i-th thread that....it is the i-th thread.
 	 * Passing i as argument to the i-th thread is the simplest
 	 * solution, so we prepare an int array where the i-th entry is i
 	 * and pass &thread_ids[i] as fourth parameter of pthread_create
-	 * function.
+	 * function (see run()).
 	 * Exercise: why can't we simply use &i as fourth argument? We'll
-     * see why next time...
-	 */
-	int* thread_ids = (int*)malloc(n * sizeof(int));
-	int i;
-	for (i = 0; i < n; i++) {
-		thread_ids[i] = i;
-		if (pthread_create(&threads[i], NULL, thread_work, &thread_ids[i]) != 0) {
-			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
-			exit(EXIT_FAILURE);
-		}
-	}
-	printf("ok\n");
-
-	/*
+	 * see why next time...
+	 *
 	 * When the i-th thread terminates, we get the sum of all its adds
-	 * (stored in shared_array[i]) and add it to computed_value
-	 * variable.
+	 * (stored in its accumulator) and add it to computed_value.
 	 */
-	printf("Waiting for the termination of all the %d threads...", n); fflush(stdout);
-	unsigned long int computed_value = 0;
-	for (i = 0; i < n; i++) {
-		pthread_join(threads[i], NULL);
-		computed_value += shared_array[i];
-	}
+	timer t;
+	unsigned long int computed_value = run(n, &t);
 	printf("ok\n");
 
 
@@ -87,9 +313,7 @@ int main(int argc, char **argv)
 		unsigned long int lost_adds = (expected_value - computed_value) / v;
 		printf("Number of lost adds: %lu\n", lost_adds);
 	}
+	printf("It took %llu milliseconds\n", get_milliseconds(&t));
 
-	free(shared_array);
-	free(threads);
-	free(thread_ids);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,214 @@
+#include "performance.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+/*
+ * do_work() writes one int every STEP elements: here the same idea is
+ * generalized to the kernels of memory.h, over working sets from the L1
+ * cache to well beyond the last level cache, to find the bandwidth and
+ * latency cliffs of the host.
+ *
+ * The buffer is initialized by the main thread, then every kernel runs
+ * in a new thread and in a forked child. Each of them times its first
+ * sweep on its own and then enough sweeps to make MIN_ACCESSES accesses
+ * (steady state). In the thread the two are close; in the child every
+ * page written during the first sweep is copied on write, and the
+ * difference tells how much fork() costs to each pattern.
+ */
+#define MIN_ACCESSES    (1 << 24)
+#define MAX_BYTES       (1UL << 30)
+#define MAX_SIZES       16
+#define STRIDE          16  // longs, two cache lines
+
+#define EXEC_THREAD     0
+#define EXEC_PROCESS    1
+
+typedef struct {
+	unsigned long long first;   // ns of the first sweep
+	unsigned long long steady;  // ns of the remaining sweeps
+	size_t sweeps;
+	long checksum;
+} result_t;
+
+result_t* result = NULL; // in MAP_SHARED memory, written by threads and children
+
+void measure(workload* w) {
+	timer t;
+	size_t per_sweep = workload_accesses(w);
+	result->sweeps = (MIN_ACCESSES + per_sweep - 1) / per_sweep;
+
+	begin(&t);
+	result->checksum = workload_run(w, 1);
+	end(&t);
+	result->first = get_nanoseconds(&t);
+
+	begin(&t);
+	result->checksum += workload_run(w, result->sweeps);
+	end(&t);
+	result->steady = get_nanoseconds(&t);
+}
+
+void* thread_fun(void* arg) {
+	measure((workload*)arg);
+	pthread_exit(NULL);
+}
+
+void run(workload* w, int exec) {
+	int ret;
+	if (exec == EXEC_THREAD) {
+		pthread_t thread;
+		ret = pthread_create(&thread, NULL, thread_fun, w);
+		if (ret != 0) {
+			fprintf(stderr, "Can't create a new thread, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+		ret = pthread_join(thread, NULL);
+		if (ret != 0) {
+			fprintf(stderr, "Cannot join on thread, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+	} else {
+		pid_t pid = fork();
+		if (pid == -1) {
+			fprintf(stderr, "Can't fork, error %d\n", errno);
+			exit(EXIT_FAILURE);
+		} else if (pid == 0) {
+			measure(w);
+			_exit(EXIT_SUCCESS);
+		}
+		int status;
+		if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			fprintf(stderr, "Child process failed\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+// parses sizes such as 32K, 4M or 1G
+size_t parse_size(const char* s) {
+	char* suffix;
+	size_t size = strtoul(s, &suffix, 10);
+	switch (*suffix) {
+	case 'G': case 'g': size <<= 10; /* fall through */
+	case 'M': case 'm': size <<= 10; /* fall through */
+	case 'K': case 'k': size <<= 10;
+	}
+	return size;
+}
+
+/*
+ * Half of every cache level (the working set fits) and four times the
+ * last level cache (it does not), capped at MAX_BYTES.
+ */
+int default_sizes(size_t* sizes) {
+	long levels[] = { sysconf(_SC_LEVEL1_DCACHE_SIZE), sysconf(_SC_LEVEL2_CACHE_SIZE),
+			sysconf(_SC_LEVEL3_CACHE_SIZE) };
+	long fallback[] = { 32 << 10, 1 << 20, 32 << 20 };
+	size_t llc = 0;
+	int i, n = 0;
+	for (i = 0; i < 3; i++) {
+		long size = (levels[i] > 0) ? levels[i] : fallback[i];
+		sizes[n++] = size / 2;
+		llc = size;
+	}
+	sizes[n++] = (4 * llc < MAX_BYTES) ? 4 * llc : MAX_BYTES;
+	return n;
+}
+
+void print_size(size_t bytes) {
+	if (bytes >= (1 << 20)) printf("%7zuM", bytes >> 20);
+	else printf("%7zuK", bytes >> 10);
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s [-p sequential|strided|chase|all] [-o read|write|rmw|all] "
+			"[-s <size>[,<size>...]] [-S <stride>] [-P <prefetch>] [-x thread|process|all] "
+			"[-T clock|tsc]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+	int pattern = -1, op = -1, exec = -1, source = TIMER_CLOCK, opt;
+	size_t sizes[MAX_SIZES], stride = STRIDE, prefetch = 0;
+	int num_sizes = default_sizes(sizes);
+	char* token;
+	while ((opt = getopt(argc, argv, "p:o:s:S:P:x:T:")) != -1) {
+		switch (opt) {
+		case 'p':
+			if (strcmp(optarg, "all") != 0 && (pattern = parse_pattern(optarg)) < 0) usage(argv[0]);
+			break;
+		case 'o':
+			if (strcmp(optarg, "all") != 0 && (op = parse_op(optarg)) < 0) usage(argv[0]);
+			break;
+		case 's':
+			num_sizes = 0;
+			for (token = strtok(optarg, ","); token != NULL; token = strtok(NULL, ","))
+				if (num_sizes == MAX_SIZES || (sizes[num_sizes++] = parse_size(token)) == 0) usage(argv[0]);
+			break;
+		case 'S': stride = strtoul(optarg, NULL, 10); break;
+		case 'P': prefetch = strtoul(optarg, NULL, 10); break;
+		case 'x':
+			if (strcmp(optarg, "thread") == 0) exec = EXEC_THREAD;
+			else if (strcmp(optarg, "process") == 0) exec = EXEC_PROCESS;
+			else if (strcmp(optarg, "all") != 0) usage(argv[0]);
+			break;
+		case 'T':
+			source = parse_timer(optarg);
+			if (source < 0) usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || stride == 0 || num_sizes == 0) usage(argv[0]);
+	timer_init(source);
+
+	result = mmap(NULL, sizeof(result_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (result == MAP_FAILED) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("Memory access patterns (stride %zu longs, prefetch %zu, %s timer)\n",
+			stride, prefetch, timer_name(timer_source()));
+	printf("%-10s %-5s %8s %-7s %12s %12s %12s %10s\n", "pattern", "op", "size", "exec",
+			"first(ns)", "steady(ns)", "MB/s", "first/stdy");
+	int p, o, i, x;
+	for (p = 0; p < NUM_PATTERNS; p++) {
+		if (pattern >= 0 && p != pattern) continue;
+		for (o = 0; o < NUM_OPS; o++) {
+			if (op >= 0 && o != op) continue;
+			for (i = 0; i < num_sizes; i++) {
+				workload w;
+				if (workload_init(&w, sizes[i], p, o, stride, prefetch)) {
+					fprintf(stderr, "Cannot allocate %zu bytes!\n", sizes[i]);
+					exit(EXIT_FAILURE);
+				}
+				for (x = EXEC_THREAD; x <= EXEC_PROCESS; x++) {
+					if (exec >= 0 && x != exec) continue;
+					run(&w, x);
+
+					// nanoseconds per access, bytes moved counting one long per access
+					size_t accesses = workload_accesses(&w);
+					double first = (double)result->first / accesses;
+					double steady = (double)result->steady / (accesses * result->sweeps);
+					printf("%-10s %-5s ", pattern_name(p), op_name(o));
+					print_size(w.items * sizeof(long));
+					printf(" %-7s %12.2f %12.2f %12.0f %10.2f\n", x ? "process" : "thread",
+							first, steady, sizeof(long) / steady * 1e3, first / steady);
+					fflush(stdout);
+				}
+				workload_free(&w);
+			}
+		}
+	}
+
+	munmap(result, sizeof(result_t));
+	return EXIT_SUCCESS;
+}
@@ -1,8 +1,14 @@
+#define _GNU_SOURCE     // clone()
 #include "performance.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <pthread.h>
 
@@ -38,59 +44,283 @@
 
 #define ITEMS   (1 << 24)
 #define STEP    1024
+#define MAX_STEP 8192
 int* global_buff = NULL;
+int step = STEP;
+
+/*
+ * Spawn strategies: fork() runs do_work() on a copy-on-write image of
+ * the parent, clone(CLONE_VM) runs it directly on the parent's memory,
+ * while vfork()+exec and posix_spawn() start a fresh helper (this same
+ * program with --helper) that does nothing: they measure the cost of
+ * spawning a helper from a large parent.
+ */
+#define SPAWN_FORK      0
+#define SPAWN_VFORK     1
+#define SPAWN_POSIX     2
+#define SPAWN_CLONE     3
+
+const char* spawn_names[] = { "fork", "vfork", "posix_spawn", "clone" };
+
+/*
+ * Buffer options: calloc (as in the original program, pages are not
+ * populated until the children write them), populate (MAP_POPULATE:
+ * the children really copy every page they write), hugepage
+ * (MADV_HUGEPAGE) and shared (MAP_SHARED: no copy-on-write at all).
+ */
+#define BUFFER_CALLOC   0
+#define BUFFER_POPULATE 1
+#define BUFFER_HUGEPAGE 2
+#define BUFFER_SHARED   3
+
+const char* buffer_names[] = { "calloc", "populate", "hugepage", "shared" };
+
+#define CLONE_STACK_SIZE (256 * 1024)
+char* clone_stack = NULL;
+char* self_path = "/proc/self/exe";
+extern char** environ;
 
 void do_work() {
 	int j;
-    for (j = 0; j < ITEMS; j += STEP) {
+    for (j = 0; j < ITEMS; j += step) {
         global_buff[j] = j;
     }
 }
 
-int main(int argc, char **argv) {
-	if (argc < 2) {
-		fprintf(stderr, "Syntax: %s <N> [<debug>]\n", argv[0]);
+/*
+ * Number of distinct pages of global_buff written by do_work(): in the
+ * child each of them is a copy-on-write fault, to be compared with the
+ * minor-faults counter.
+ */
+long touched_pages() {
+	long page_items = sysconf(_SC_PAGESIZE) / sizeof(int);
+	return (step >= page_items) ? (ITEMS + step - 1) / step : (ITEMS + page_items - 1) / page_items;
+}
+
+int parse_name(const char* name, const char** names, int count) {
+	int i;
+	for (i = 0; i < count; i++)
+		if (strcmp(name, names[i]) == 0) return i;
+	return -1;
+}
+
+int* alloc_buffer(int kind) {
+	size_t size = ITEMS * sizeof(int);
+	void* buff;
+	switch (kind) {
+	case BUFFER_CALLOC:
+		return (int*)calloc(ITEMS, sizeof(int));
+	case BUFFER_POPULATE:
+		buff = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+		break;
+	case BUFFER_HUGEPAGE:
+		buff = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (buff != MAP_FAILED && madvise(buff, size, MADV_HUGEPAGE) != 0)
+			fprintf(stderr, "madvise(MADV_HUGEPAGE) failed, error %d\n", errno);
+		break;
+	default:
+		buff = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	}
+	return (buff == MAP_FAILED) ? NULL : (int*)buff;
+}
+
+/*
+ * Timings of the two passes of do_work() done by a probe child: the
+ * first pass pays the page faults, the second one only the writes.
+ */
+typedef struct {
+	unsigned long long first_pass;
+	unsigned long long second_pass;
+} probe_t;
+
+probe_t* probe = NULL; // in MAP_SHARED memory, written by the child
+
+int child_fun(void* arg) {
+	if (arg != NULL) {
+		timer t;
+		begin(&t);
+		do_work();
+		end(&t);
+		probe->first_pass = get_nanoseconds(&t);
+		begin(&t);
+		do_work();
+		end(&t);
+		probe->second_pass = get_nanoseconds(&t);
+	} else {
+		do_work();
+	}
+	return 0;
+}
+
+/*
+ * Spawns a child with the given strategy and waits for it. When probing
+ * is non-zero, fork and clone children time their do_work() passes.
+ */
+void spawn(int strategy, int probing) {
+	char* helper_argv[] = { "helper", "--helper", NULL };
+	pid_t pid;
+	switch (strategy) {
+	case SPAWN_FORK:
+		pid = fork();
+		if (pid == 0) {
+			child_fun(probing ? probe : NULL);
+			_exit(EXIT_SUCCESS);
+		}
+		break;
+	case SPAWN_VFORK:
+		pid = vfork();
+		if (pid == 0) {
+			execve(self_path, helper_argv, environ);
+			_exit(127);
+		}
+		break;
+	case SPAWN_POSIX:
+		if (posix_spawn(&pid, self_path, NULL, NULL, helper_argv, environ) != 0)
+			pid = -1;
+		break;
+	default:
+		pid = clone(child_fun, clone_stack + CLONE_STACK_SIZE, CLONE_VM | SIGCHLD, probing ? probe : NULL);
+	}
+	if (pid == -1) {
+		fprintf(stderr, "Can't spawn a child with %s, error %d\n", spawn_names[strategy], errno);
+		exit(EXIT_FAILURE);
+	}
+	int status;
+	if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "Child spawned with %s failed\n", spawn_names[strategy]);
 		exit(EXIT_FAILURE);
 	}
+}
+
+/*
+ * For every STEP from 1 to MAX_STEP prints the median spawn+work time
+ * and, for fork and clone, how it splits between spawning, page faults
+ * in the child and the writes themselves.
+ */
+void sweep(int strategy, int n, int warmup) {
+	printf("%6s %8s %12s %12s %12s %12s %8s\n", "step", "pages", "total(us)", "spawn(us)",
+			"faults(us)", "writes(us)", "faults%");
+	for (step = 1; step <= MAX_STEP; step *= 2) {
+		samples s;
+		summary sum;
+		timer t;
+		int i;
+		samples_init(&s, n, warmup);
+		for (i = 0; i < warmup + n; i++) {
+			begin(&t);
+			spawn(strategy, 0);
+			end(&t);
+			samples_add(&s, get_nanoseconds(&t));
+		}
+		samples_summarize(&s, &sum);
+		samples_free(&s);
+
+		printf("%6d %8ld %12.1f", step, touched_pages(), sum.median / 1e3);
+		if (strategy == SPAWN_FORK || strategy == SPAWN_CLONE) {
+			spawn(strategy, 1);
+			double faults = ((double)probe->first_pass - probe->second_pass) / 1e3;
+			double writes = probe->second_pass / 1e3;
+			double spawning = sum.median / 1e3 - probe->first_pass / 1e3;
+			printf(" %12.1f %12.1f %12.1f %7.1f%%\n", spawning, faults, writes,
+					100.0 * faults / (sum.median / 1e3));
+		} else {
+			printf(" %12s %12s %12s %8s\n", "-", "-", "-", "-");
+		}
+		fflush(stdout);
+	}
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s <N> [<debug>] [-x fork|vfork|posix_spawn|clone] "
+			"[-a calloc|populate|hugepage|shared] [-s <step> | -S] [-w <warmup>] "
+			"[-f text|csv|json] [-c]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+	// a helper spawned through vfork+exec or posix_spawn: nothing to do
+	if (argc > 1 && strcmp(argv[1], "--helper") == 0) return EXIT_SUCCESS;
+
+	int warmup = 0, format = FORMAT_TEXT, use_counters = 0, opt;
+	int strategy = SPAWN_FORK, buffer = BUFFER_CALLOC, step_sweep = 0;
+	while ((opt = getopt(argc, argv, "w:f:cx:a:s:S")) != -1) {
+		switch (opt) {
+		case 'w': warmup = atoi(optarg); break;
+		case 'c': use_counters = 1; break;
+		case 's': step = atoi(optarg); break;
+		case 'S': step_sweep = 1; break;
+		case 'f':
+			format = parse_format(optarg);
+			if (format < 0) usage(argv[0]);
+			break;
+		case 'x':
+			strategy = parse_name(optarg, spawn_names, 4);
+			if (strategy < 0) usage(argv[0]);
+			break;
+		case 'a':
+			buffer = parse_name(optarg, buffer_names, 4);
+			if (buffer < 0) usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (argc - optind < 1 || step < 1) usage(argv[0]);
 	
 	// parse N from the command line
-	int n = atoi(argv[1]);
+	int n = atoi(argv[optind]);
 	
 	// debug mode: use 0 (off) when only N is given as argument
-	int debug = (argc > 2) ? atoi(argv[2]) : 0;
+	int debug = (argc - optind > 1) ? atoi(argv[optind + 1]) : 0;
 	
 	// allocate a large buffer of zeroed memory 
-	global_buff = (int*)calloc(ITEMS, sizeof(int));
-    if (global_buff == NULL) {
+	global_buff = alloc_buffer(buffer);
+	probe = (probe_t*)mmap(NULL, sizeof(probe_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	clone_stack = (char*)malloc(CLONE_STACK_SIZE);
+    if (global_buff == NULL || probe == MAP_FAILED || clone_stack == NULL) {
         fprintf(stderr, "Cannot allocate memory!\n");
         exit(EXIT_FAILURE);
     }
 	
-	// process reactivity
-	printf("Process reactivity, %d tests...\n", n);
-	unsigned long sum = 0;
+	if (step_sweep) {
+		printf("Process reactivity (%s, %s buffer), STEP sweep with %d tests per step (%d warmup)...\n",
+				spawn_names[strategy], buffer_names[buffer], n, warmup);
+		sweep(strategy, n, warmup);
+		return EXIT_SUCCESS;
+	}
+
+	// process reactivity: every spawn+wait is timed on its own
+	if (format == FORMAT_TEXT)
+		printf("Process reactivity (%s, %s buffer, STEP %d), %d tests (%d warmup)...\n",
+				spawn_names[strategy], buffer_names[buffer], step, n, warmup);
+	samples s;
+	samples_init(&s, n, warmup);
 	timer t;
 	int i;
 
-	begin(&t);
-	for (i = 0; i < n; i++) {
-		pid_t pid = fork();
-		if (pid == -1) {
-			fprintf(stderr, "Can't fork, error %d\n", errno);
-			exit(EXIT_FAILURE);
-		} else if (pid == 0) {
-			do_work();
-			_exit(EXIT_SUCCESS);
-		} else {
-			wait(0);
-		}
+	counters c;
+	if (use_counters && counters_open(&c) == 0 && format == FORMAT_TEXT)
+		printf("perf events not permitted, using getrusage() only\n");
+
+	for (i = 0; i < warmup + n; i++) {
+		if (use_counters && i == warmup) counters_begin(&c);
+		begin(&t);
+		spawn(strategy, 0);
+		end(&t);
+		samples_add(&s, get_nanoseconds(&t));
+		if (debug) fprintf(stderr, "[%d] %llu ns\n", i, get_nanoseconds(&t));
 	}
-	end(&t);
-	sum += get_microseconds(&t);
+	
+	if (use_counters) counters_end(&c);
 	
 	// compute statistics
-	unsigned long process_avg = sum / n;
-	printf("Average: %lu microseconds\n", process_avg);
+	report(stdout, spawn_names[strategy], &s, format, 1);
+	if (use_counters) {
+		report_counters(stdout, spawn_names[strategy], &c, n, format);
+		if (format == FORMAT_TEXT && strategy == SPAWN_FORK)
+			printf("do_work() touches %ld pages of global_buff (copy-on-write faults per child)\n", touched_pages());
+		counters_close(&c);
+	}
+	samples_free(&s);
 	
 	return EXIT_SUCCESS;
 }
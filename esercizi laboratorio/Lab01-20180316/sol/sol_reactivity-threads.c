@@ -1,6 +1,8 @@
 #include "performance.h"
+#include "stats.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/wait.h>
@@ -10,6 +12,38 @@
 #define STEP    1024
 int* global_buff = NULL;
 
+/*
+ * Besides creating and joining a thread for every do_work() call
+ * (create mode), work can be handed to a pool of pre-spawned workers
+ * sleeping on a condition variable, either one task at a time (pool
+ * mode) or BATCH tasks at a time (batch mode). For every task we also
+ * measure the dispatch latency, i.e. the time from the submission (or
+ * the pthread_create call) to the moment do_work() starts running.
+ */
+#define MODE_CREATE 0
+#define MODE_POOL   1
+#define MODE_BATCH  2
+
+#define BATCH   16
+
+typedef struct {
+	timer dispatch; // started by the submitter, stopped by the worker
+} task_t;
+
+// pool of workers waiting for tasks on a condition variable
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t work_available;
+	pthread_cond_t work_done;
+	task_t** queue;     // circular buffer of pending tasks
+	int capacity;
+	int head, pending;
+	int completed;      // tasks completed since the last submission
+	int shutdown;
+	pthread_t* workers;
+	int num_workers;
+} pool_t;
+
 void do_work() {
     int j;
     for (j = 0; j < ITEMS; j += STEP) {
@@ -18,53 +52,206 @@ void do_work() {
 }
 
 void* thread_fun(void *arg) {
+	task_t* task = (task_t*)arg;
+	end(&task->dispatch);
 	do_work();
 	pthread_exit(NULL);
 }
 
+void* worker_fun(void *arg) {
+	pool_t* pool = (pool_t*)arg;
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (pool->pending == 0 && !pool->shutdown)
+			pthread_cond_wait(&pool->work_available, &pool->lock);
+		if (pool->pending == 0) break; // shutdown and nothing left to do
+
+		task_t* task = pool->queue[pool->head];
+		pool->head = (pool->head + 1) % pool->capacity;
+		pool->pending--;
+		pthread_mutex_unlock(&pool->lock);
+
+		end(&task->dispatch);
+		do_work();
+
+		pthread_mutex_lock(&pool->lock);
+		pool->completed++;
+		pthread_cond_signal(&pool->work_done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+void pool_init(pool_t* pool, int num_workers, int capacity) {
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_available, NULL);
+	pthread_cond_init(&pool->work_done, NULL);
+	pool->queue = (task_t**)malloc(capacity * sizeof(task_t*));
+	pool->capacity = capacity;
+	pool->head = pool->pending = pool->completed = pool->shutdown = 0;
+	pool->workers = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+	pool->num_workers = num_workers;
+
+	int i, ret;
+	for (i = 0; i < num_workers; i++) {
+		ret = pthread_create(&pool->workers[i], NULL, worker_fun, pool);
+		if (ret != 0) {
+			fprintf(stderr, "Can't create a new thread, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/*
+ * Hands count tasks to the workers and waits for all of them to be
+ * completed. count must not exceed the capacity of the pool queue.
+ */
+void pool_run(pool_t* pool, task_t* tasks, int count) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->completed = 0;
+	for (i = 0; i < count; i++) {
+		begin(&tasks[i].dispatch);
+		pool->queue[(pool->head + pool->pending) % pool->capacity] = &tasks[i];
+		pool->pending++;
+	}
+	if (count == 1)
+		pthread_cond_signal(&pool->work_available);
+	else
+		pthread_cond_broadcast(&pool->work_available);
+	while (pool->completed < count)
+		pthread_cond_wait(&pool->work_done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_destroy(pool_t* pool) {
+	int i;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->work_available);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->num_workers; i++)
+		pthread_join(pool->workers[i], NULL);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->work_available);
+	pthread_cond_destroy(&pool->work_done);
+	free(pool->queue);
+	free(pool->workers);
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s <N> [-m create|pool|batch] [-p <workers>] [-b <batch>] "
+			"[-w <warmup>] [-f text|csv|json] [-c] [-T clock|tsc]\n", prog);
+	exit(EXIT_FAILURE);
+}
 
 int main(int argc, char **argv) {
-	if (argc != 2) {
-		fprintf(stderr, "Syntax: %s <N>\n", argv[0]);
-		exit(EXIT_FAILURE);
+	int warmup = 0, format = FORMAT_TEXT, use_counters = 0, opt;
+	int mode = MODE_CREATE, batch = BATCH, source = TIMER_CLOCK;
+	int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "w:f:cm:p:b:T:")) != -1) {
+		switch (opt) {
+		case 'w': warmup = atoi(optarg); break;
+		case 'c': use_counters = 1; break;
+		case 'p': workers = atoi(optarg); break;
+		case 'b': batch = atoi(optarg); break;
+		case 'f':
+			format = parse_format(optarg);
+			if (format < 0) usage(argv[0]);
+			break;
+		case 'T':
+			source = parse_timer(optarg);
+			if (source < 0) usage(argv[0]);
+			break;
+		case 'm':
+			if (strcmp(optarg, "create") == 0) mode = MODE_CREATE;
+			else if (strcmp(optarg, "pool") == 0) mode = MODE_POOL;
+			else if (strcmp(optarg, "batch") == 0) mode = MODE_BATCH;
+			else usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
 	}
-	
+	if (argc - optind != 1 || workers < 1 || batch < 1) usage(argv[0]);
+
+	// dispatch latencies are a few microseconds: the TSC is worth it
+	if (timer_init(source) != source && format == FORMAT_TEXT)
+		printf("TSC not invariant, using clock_gettime()\n");
+
 	// parse N from the command line
-	int n = atoi(argv[1]);
-	
-	// allocate a large buffer of zeroed memory 
+	int n = atoi(argv[optind]);
+
+	// allocate a large buffer of zeroed memory
 	global_buff = (int*)calloc(ITEMS, sizeof(int));
     if (global_buff == NULL) {
         fprintf(stderr, "Cannot allocate memory!\n");
         exit(EXIT_FAILURE);
     }
 
-	// thread reactivity
-	printf("Thread reactivity, %d tests...\n", n);
-	unsigned long sum = 0;
+	/*
+	 * Thread reactivity: every create+join (or submission+completion
+	 * in the pool modes) is timed on its own. In batch mode each batch
+	 * is timed and divided by its size.
+	 */
+	static const char* labels[] = { "thread", "pool", "batch" };
+	static const char* dispatch_labels[] = { "thread-dispatch", "pool-dispatch", "batch-dispatch" };
+	int per_round = (mode == MODE_BATCH) ? batch : 1;
+	if (format == FORMAT_TEXT) {
+		printf("Thread reactivity (%s mode", labels[mode]);
+		if (mode != MODE_CREATE) printf(", %d workers", workers);
+		if (mode == MODE_BATCH) printf(", batches of %d", batch);
+		printf("), %d tests (%d warmup, %s timer)...\n", n, warmup, timer_name(timer_source()));
+	}
+	samples s, dispatch;
+	samples_init(&s, n, warmup);
+	samples_init(&dispatch, (size_t)n * per_round, (size_t)warmup * per_round);
+	task_t* tasks = (task_t*)malloc(per_round * sizeof(task_t));
+	pool_t pool;
+	if (mode != MODE_CREATE) pool_init(&pool, workers, per_round);
 	timer t;
-	int i, ret;
+	int i, j, ret;
 
-	begin(&t);
-	for (i = 0; i < n; i++) {
-		pthread_t thread;
-		ret = pthread_create(&thread, NULL, thread_fun, NULL);
-		if (ret != 0) {
-			fprintf(stderr, "Can't create a new thread, error %d\n", ret);
-			exit(EXIT_FAILURE);
-		}
-		ret = pthread_join(thread, NULL);
-		if (ret != 0) {
-			fprintf(stderr, "Cannot join on thread, error %d\n", ret);
-			exit(EXIT_FAILURE);
+	counters c;
+	if (use_counters && counters_open(&c) == 0 && format == FORMAT_TEXT)
+		printf("perf events not permitted, using getrusage() only\n");
+
+	for (i = 0; i < warmup + n; i++) {
+		if (use_counters && i == warmup) counters_begin(&c);
+		begin(&t);
+		if (mode == MODE_CREATE) {
+			pthread_t thread;
+			begin(&tasks[0].dispatch);
+			ret = pthread_create(&thread, NULL, thread_fun, &tasks[0]);
+			if (ret != 0) {
+				fprintf(stderr, "Can't create a new thread, error %d\n", ret);
+				exit(EXIT_FAILURE);
+			}
+			ret = pthread_join(thread, NULL);
+			if (ret != 0) {
+				fprintf(stderr, "Cannot join on thread, error %d\n", ret);
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			pool_run(&pool, tasks, per_round);
 		}
+		end(&t);
+		samples_add(&s, get_nanoseconds(&t) / per_round);
+		for (j = 0; j < per_round; j++)
+			samples_add(&dispatch, get_nanoseconds(&tasks[j].dispatch));
 	}
-	end(&t);
-	sum += get_microseconds(&t);
-	
+	if (use_counters) counters_end(&c);
+
 	// compute statistics
-	unsigned long thread_avg = sum / n;
-	printf("Average: %lu microseconds\n", thread_avg);
+	report(stdout, labels[mode], &s, format, 1);
+	report(stdout, dispatch_labels[mode], &dispatch, format, 0);
+	if (use_counters) {
+		report_counters(stdout, labels[mode], &c, n, format);
+		counters_close(&c);
+	}
+	if (mode != MODE_CREATE) pool_destroy(&pool);
+	samples_free(&s);
+	samples_free(&dispatch);
+	free(tasks);
 
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE     // pthread_setaffinity_np()
+#include "performance.h"
+#include "stats.h"
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/*
+ * Wakeup latency of the primitives the labs use to hand work over
+ * between threads or processes. A pinger starts the timer and wakes up
+ * a ponger blocked on the primitive; the first thing the ponger does is
+ * stopping the timer, then it wakes up the pinger the same way. Every
+ * round trip gives two samples, one per direction: the time from the
+ * signal to the moment the woken side runs again, cyclictest-style.
+ *
+ * Both sides are pinned on the same CPU (same mode: every wakeup is
+ * also a context switch) or on two different CPUs (cross mode: the
+ * ponger is idle and sleeping, the wakeup needs an IPI).
+ */
+#define PRIM_SEM        0
+#define PRIM_NAMED_SEM  1
+#define PRIM_COND       2
+#define PRIM_FUTEX      3
+#define PRIM_EVENTFD    4
+#define PRIM_PIPE       5
+#define PRIM_FIFO       6
+#define NUM_PRIMS       7
+
+static const char* prim_names[NUM_PRIMS] = {
+	"sem", "named-sem", "cond", "futex", "eventfd", "pipe", "fifo"
+};
+
+#define SEM_PING    "/wakeup_ping"
+#define SEM_PONG    "/wakeup_pong"
+#define FIFO_PING   "/tmp/wakeup_ping"
+#define FIFO_PONG   "/tmp/wakeup_pong"
+
+#define PING    0
+#define PONG    1
+
+/*
+ * Everything the two sides share lives in a MAP_SHARED mapping created
+ * before fork(), so that the same code works for threads and processes.
+ */
+typedef struct {
+	int prim;
+	int rounds;
+	int cpus[2];                // placement index of the pinger and the ponger
+	timer t;                    // started by the waker, stopped by the woken
+	unsigned long long latency; // last sample, written by the ponger
+	sem_t sem[2];
+	sem_t* named[2];
+	pthread_mutex_t lock;
+	pthread_cond_t cond[2];
+	int turn;                   // PING or PONG, for cond and futex
+	int fd[2][2];               // [direction][read end, write end]
+} channel_t;
+
+static void fail(const char* what) {
+	fprintf(stderr, "%s error: %s\n", what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void setup(channel_t* c) {
+	int i;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+
+	c->turn = PING;
+	switch (c->prim) {
+	case PRIM_SEM:
+		for (i = 0; i < 2; i++)
+			if (sem_init(&c->sem[i], 1, 0)) fail("sem_init");
+		break;
+	case PRIM_NAMED_SEM:
+		sem_unlink(SEM_PING);
+		sem_unlink(SEM_PONG);
+		c->named[PING] = sem_open(SEM_PING, O_CREAT | O_EXCL, 0600, 0);
+		c->named[PONG] = sem_open(SEM_PONG, O_CREAT | O_EXCL, 0600, 0);
+		if (c->named[PING] == SEM_FAILED || c->named[PONG] == SEM_FAILED) fail("sem_open");
+		break;
+	case PRIM_COND:
+		pthread_mutexattr_init(&mattr);
+		pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+		pthread_mutex_init(&c->lock, &mattr);
+		pthread_mutexattr_destroy(&mattr);
+		pthread_condattr_init(&cattr);
+		pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+		for (i = 0; i < 2; i++)
+			pthread_cond_init(&c->cond[i], &cattr);
+		pthread_condattr_destroy(&cattr);
+		break;
+	case PRIM_FUTEX:
+		break;
+	case PRIM_EVENTFD:
+		// the same counter is both the read and the write end
+		for (i = 0; i < 2; i++) {
+			c->fd[i][0] = c->fd[i][1] = eventfd(0, 0);
+			if (c->fd[i][0] == -1) fail("eventfd");
+		}
+		break;
+	case PRIM_PIPE:
+		for (i = 0; i < 2; i++)
+			if (pipe(c->fd[i])) fail("pipe");
+		break;
+	case PRIM_FIFO:
+		/*
+		 * Opening both FIFOs O_RDWR does not block waiting for the
+		 * other end (Linux-specific) and the descriptors are then
+		 * inherited by the child like the ones of a pipe.
+		 */
+		unlink(FIFO_PING);
+		unlink(FIFO_PONG);
+		if (mkfifo(FIFO_PING, 0600) || mkfifo(FIFO_PONG, 0600)) fail("mkfifo");
+		c->fd[PING][0] = c->fd[PING][1] = open(FIFO_PING, O_RDWR);
+		c->fd[PONG][0] = c->fd[PONG][1] = open(FIFO_PONG, O_RDWR);
+		if (c->fd[PING][0] == -1 || c->fd[PONG][0] == -1) fail("open");
+		break;
+	}
+}
+
+static void cleanup(channel_t* c) {
+	int i;
+	switch (c->prim) {
+	case PRIM_SEM:
+		for (i = 0; i < 2; i++)
+			sem_destroy(&c->sem[i]);
+		break;
+	case PRIM_NAMED_SEM:
+		for (i = 0; i < 2; i++)
+			sem_close(c->named[i]);
+		sem_unlink(SEM_PING);
+		sem_unlink(SEM_PONG);
+		break;
+	case PRIM_COND:
+		pthread_mutex_destroy(&c->lock);
+		for (i = 0; i < 2; i++)
+			pthread_cond_destroy(&c->cond[i]);
+		break;
+	case PRIM_EVENTFD:
+		for (i = 0; i < 2; i++)
+			close(c->fd[i][0]);
+		break;
+	case PRIM_PIPE:
+		for (i = 0; i < 2; i++) {
+			close(c->fd[i][0]);
+			close(c->fd[i][1]);
+		}
+		break;
+	case PRIM_FIFO:
+		for (i = 0; i < 2; i++)
+			close(c->fd[i][0]);
+		unlink(FIFO_PING);
+		unlink(FIFO_PONG);
+		break;
+	}
+}
+
+static void futex_wait(int* addr, int value) {
+	// shared futexes, the word may be in another process
+	syscall(SYS_futex, addr, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+static void futex_wake(int* addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// wakes up the side waiting on direction dir
+static void signal_side(channel_t* c, int dir) {
+	unsigned long long one = 1;
+	switch (c->prim) {
+	case PRIM_SEM:
+		if (sem_post(&c->sem[dir])) fail("sem_post");
+		break;
+	case PRIM_NAMED_SEM:
+		if (sem_post(c->named[dir])) fail("sem_post");
+		break;
+	case PRIM_COND:
+		pthread_mutex_lock(&c->lock);
+		c->turn = dir;
+		pthread_cond_signal(&c->cond[dir]);
+		pthread_mutex_unlock(&c->lock);
+		break;
+	case PRIM_FUTEX:
+		__atomic_store_n(&c->turn, dir, __ATOMIC_RELEASE);
+		futex_wake(&c->turn);
+		break;
+	case PRIM_EVENTFD:
+		if (write(c->fd[dir][1], &one, sizeof(one)) != sizeof(one)) fail("write");
+		break;
+	case PRIM_PIPE:
+	case PRIM_FIFO:
+		if (write(c->fd[dir][1], &one, 1) != 1) fail("write");
+		break;
+	}
+}
+
+// blocks until the other side signals direction dir
+static void wait_side(channel_t* c, int dir) {
+	unsigned long long value;
+	switch (c->prim) {
+	case PRIM_SEM:
+		while (sem_wait(&c->sem[dir]))
+			if (errno != EINTR) fail("sem_wait");
+		break;
+	case PRIM_NAMED_SEM:
+		while (sem_wait(c->named[dir]))
+			if (errno != EINTR) fail("sem_wait");
+		break;
+	case PRIM_COND:
+		pthread_mutex_lock(&c->lock);
+		while (c->turn != dir)
+			pthread_cond_wait(&c->cond[dir], &c->lock);
+		pthread_mutex_unlock(&c->lock);
+		break;
+	case PRIM_FUTEX:
+		while (__atomic_load_n(&c->turn, __ATOMIC_ACQUIRE) != dir)
+			futex_wait(&c->turn, 1 - dir);
+		break;
+	case PRIM_EVENTFD:
+		if (read(c->fd[dir][0], &value, sizeof(value)) != sizeof(value)) fail("read");
+		break;
+	case PRIM_PIPE:
+	case PRIM_FIFO:
+		if (read(c->fd[dir][0], &value, 1) != 1) fail("read");
+		break;
+	}
+}
+
+static void ponger(channel_t* c) {
+	place_thread(PLACEMENT_COMPACT, c->cpus[PONG]);
+	int i;
+	for (i = 0; i < c->rounds; i++) {
+		wait_side(c, PONG);
+		end(&c->t);
+		c->latency = get_nanoseconds(&c->t);
+		begin(&c->t);
+		signal_side(c, PING);
+	}
+}
+
+static void* ponger_thread(void* arg) {
+	ponger((channel_t*)arg);
+	return NULL;
+}
+
+// the pinger side: both directions give a sample per round
+static void pinger(channel_t* c, samples* s) {
+	place_thread(PLACEMENT_COMPACT, c->cpus[PING]);
+	int i;
+	for (i = 0; i < c->rounds; i++) {
+		begin(&c->t);
+		signal_side(c, PONG);
+		wait_side(c, PING);
+		end(&c->t);
+		samples_add(s, c->latency);
+		samples_add(s, get_nanoseconds(&c->t));
+	}
+}
+
+static void run(channel_t* c, int processes, samples* s) {
+	setup(c);
+	if (processes) {
+		pid_t pid = fork();
+		if (pid == -1) fail("fork");
+		if (pid == 0) {
+			ponger(c);
+			_exit(EXIT_SUCCESS);
+		}
+		pinger(c, s);
+		if (waitpid(pid, NULL, 0) == -1) fail("waitpid");
+	} else {
+		pthread_t thread;
+		int ret = pthread_create(&thread, NULL, ponger_thread, c);
+		if (ret != 0) {
+			fprintf(stderr, "Can't create a new thread, error %d\n", ret);
+			exit(EXIT_FAILURE);
+		}
+		pinger(c, s);
+		pthread_join(thread, NULL);
+	}
+	cleanup(c);
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s <N> [-P sem|named-sem|cond|futex|eventfd|pipe|fifo|all] "
+			"[-x threads|processes|both] [-a same|cross|both] [-w <warmup>] "
+			"[-f text|csv|json] [-T clock|tsc]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+	int warmup = 100, format = FORMAT_TEXT, source = TIMER_TSC, opt, i;
+	int prim = -1;              // all of them
+	int first_exec = 0, last_exec = 1, first_place = 0, last_place = 1;
+	while ((opt = getopt(argc, argv, "P:x:a:w:f:T:")) != -1) {
+		switch (opt) {
+		case 'P':
+			if (strcmp(optarg, "all") == 0) break;
+			for (prim = 0; prim < NUM_PRIMS; prim++)
+				if (strcmp(optarg, prim_names[prim]) == 0) break;
+			if (prim == NUM_PRIMS) usage(argv[0]);
+			break;
+		case 'x':
+			if (strcmp(optarg, "threads") == 0) last_exec = 0;
+			else if (strcmp(optarg, "processes") == 0) first_exec = 1;
+			else if (strcmp(optarg, "both") != 0) usage(argv[0]);
+			break;
+		case 'a':
+			if (strcmp(optarg, "same") == 0) last_place = 0;
+			else if (strcmp(optarg, "cross") == 0) first_place = 1;
+			else if (strcmp(optarg, "both") != 0) usage(argv[0]);
+			break;
+		case 'w': warmup = atoi(optarg); break;
+		case 'f':
+			format = parse_format(optarg);
+			if (format < 0) usage(argv[0]);
+			break;
+		case 'T':
+			source = parse_timer(optarg);
+			if (source < 0) usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1) usage(argv[0]);
+	int n = atoi(argv[optind]);
+	if (n < 1 || warmup < 0) usage(argv[0]);
+
+	// sub-microsecond differences matter here: prefer the TSC
+	timer_init(source);
+	placement_init();
+	if (online_cpus() < 2 && last_place == 1) {
+		if (format == FORMAT_TEXT)
+			printf("Only one CPU available, skipping the cross-core runs\n");
+		last_place = 0;
+		if (first_place == 1) return EXIT_SUCCESS;
+	}
+
+	channel_t* c = mmap(NULL, sizeof(channel_t), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (c == MAP_FAILED) fail("mmap");
+
+	if (format == FORMAT_TEXT)
+		printf("Wakeup latency, %d round trips (%d warmup), %s timer\n", n, warmup,
+				timer_name(timer_source()));
+	int header = 1, exec, place;
+	for (i = 0; i < NUM_PRIMS; i++) {
+		if (prim >= 0 && i != prim) continue;
+		for (exec = first_exec; exec <= last_exec; exec++) {
+			for (place = first_place; place <= last_place; place++) {
+				memset(c, 0, sizeof(channel_t));
+				c->prim = i;
+				c->rounds = warmup + n;
+				c->cpus[PING] = 0;
+				c->cpus[PONG] = place; // index 1 is another CPU
+				samples s;
+				samples_init(&s, 2 * (size_t)n, 2 * (size_t)warmup);
+				run(c, exec, &s);
+
+				char label[64];
+				snprintf(label, sizeof(label), "%s/%s/%s", prim_names[i],
+						exec ? "processes" : "threads", place ? "cross" : "same");
+				report(stdout, label, &s, format, header);
+				header = 0;
+				samples_free(&s);
+			}
+		}
+	}
+
+	munmap(c, sizeof(channel_t));
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/utsname.h>
+
+#define SUB_BUCKETS (1ULL << HISTOGRAM_SUB_BITS)
+
+void samples_init(samples* s, size_t capacity, size_t warmup) {
+	s->values = (unsigned long long*)malloc(capacity * sizeof(unsigned long long));
+	if (s->values == NULL && capacity > 0) {
+		fprintf(stderr, "Cannot allocate memory for %zu samples!\n", capacity);
+		exit(EXIT_FAILURE);
+	}
+	s->count = 0;
+	s->capacity = capacity;
+	s->warmup = warmup;
+}
+
+void samples_add(samples* s, unsigned long long ns) {
+	if (s->warmup > 0) {
+		s->warmup--;
+		return;
+	}
+	if (s->count < s->capacity)
+		s->values[s->count++] = ns;
+}
+
+void samples_free(samples* s) {
+	free(s->values);
+	s->values = NULL;
+	s->count = s->capacity = 0;
+}
+
+static int compare_ull(const void* a, const void* b) {
+	unsigned long long x = *(const unsigned long long*)a;
+	unsigned long long y = *(const unsigned long long*)b;
+	return (x > y) - (x < y);
+}
+
+// nearest-rank percentile on sorted values, p in [0, 1]
+static unsigned long long percentile(samples* s, double p) {
+	size_t rank = (size_t)ceil(p * s->count);
+	if (rank == 0) rank = 1;
+	return s->values[rank - 1];
+}
+
+void samples_summarize(samples* s, summary* sum) {
+	memset(sum, 0, sizeof(summary));
+	sum->count = s->count;
+	if (s->count == 0) return;
+
+	qsort(s->values, s->count, sizeof(unsigned long long), compare_ull);
+	sum->min    = s->values[0];
+	sum->max    = s->values[s->count - 1];
+	sum->median = percentile(s, 0.5);
+	sum->p90    = percentile(s, 0.9);
+	sum->p99    = percentile(s, 0.99);
+	sum->p999   = percentile(s, 0.999);
+
+	size_t i;
+	double total = 0, squares = 0;
+	for (i = 0; i < s->count; i++)
+		total += s->values[i];
+	sum->mean = total / s->count;
+	for (i = 0; i < s->count; i++)
+		squares += (s->values[i] - sum->mean) * (s->values[i] - sum->mean);
+	sum->stddev = sqrt(squares / s->count);
+}
+
+static int histogram_index(unsigned long long value) {
+	if (value < SUB_BUCKETS) return (int)value;
+	int e = 63 - __builtin_clzll(value); // position of the highest bit
+	int shift = e - HISTOGRAM_SUB_BITS;
+	int sub = (int)((value >> shift) - SUB_BUCKETS);
+	return ((shift + 1) << HISTOGRAM_SUB_BITS) + sub;
+}
+
+unsigned long long histogram_bucket_low(int index) {
+	if (index < (int)SUB_BUCKETS) return index;
+	int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+	unsigned long long sub = index & (SUB_BUCKETS - 1);
+	return (SUB_BUCKETS + sub) << shift;
+}
+
+unsigned long long histogram_bucket_high(int index) {
+	if (index == HISTOGRAM_BUCKETS - 1) return ~0ULL;
+	return histogram_bucket_low(index + 1);
+}
+
+void histogram_add(histogram* h, unsigned long long value) {
+	h->counts[histogram_index(value)]++;
+	h->total++;
+}
+
+void samples_histogram(samples* s, histogram* h) {
+	memset(h, 0, sizeof(histogram));
+	size_t i;
+	for (i = 0; i < s->count; i++)
+		histogram_add(h, s->values[i]);
+}
+
+int parse_format(const char* name) {
+	if (strcmp(name, "text") == 0) return FORMAT_TEXT;
+	if (strcmp(name, "csv") == 0) return FORMAT_CSV;
+	if (strcmp(name, "json") == 0) return FORMAT_JSON;
+	return -1;
+}
+
+static void print_text(FILE* out, const char* label, summary* sum, histogram* h) {
+	fprintf(out, "%s: %zu samples (microseconds)\n", label, sum->count);
+	if (sum->count == 0) return;
+	fprintf(out, "  min %.3f  median %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+			sum->min / 1e3, sum->median / 1e3, sum->p90 / 1e3, sum->p99 / 1e3,
+			sum->p999 / 1e3, sum->max / 1e3);
+	fprintf(out, "  mean %.3f  stddev %.3f\n", sum->mean / 1e3, sum->stddev / 1e3);
+
+	/*
+	 * On the console one row per power of two is enough: the linear
+	 * sub-buckets are still available through the JSON output.
+	 */
+	unsigned long long cumulative = 0;
+	int i = 0;
+	while (i < HISTOGRAM_BUCKETS) {
+		int last = (i < (int)SUB_BUCKETS) ? (int)SUB_BUCKETS - 1 : (i | (int)(SUB_BUCKETS - 1));
+		unsigned long long count = 0;
+		int j;
+		for (j = i; j <= last; j++)
+			count += h->counts[j];
+		if (count > 0) {
+			cumulative += count;
+			int bar = (int)(40 * count / h->total);
+			fprintf(out, "  [%12.3f, %12.3f) %10llu %7.3f%% ", histogram_bucket_low(i) / 1e3,
+					histogram_bucket_high(last) / 1e3, count, 100.0 * cumulative / h->total);
+			while (bar-- > 0) fputc('#', out);
+			fputc('\n', out);
+		}
+		i = last + 1;
+	}
+}
+
+static void print_csv(FILE* out, const char* label, const char* kernel, summary* sum, int header) {
+	if (header)
+		fprintf(out, "label,kernel,count,min_ns,median_ns,p90_ns,p99_ns,p999_ns,max_ns,mean_ns,stddev_ns\n");
+	fprintf(out, "%s,%s,%zu,%llu,%llu,%llu,%llu,%llu,%llu,%.1f,%.1f\n", label, kernel, sum->count,
+			sum->min, sum->median, sum->p90, sum->p99, sum->p999, sum->max, sum->mean, sum->stddev);
+}
+
+static void print_json(FILE* out, const char* label, const char* kernel, summary* sum, histogram* h) {
+	fprintf(out, "{\"label\": \"%s\", \"kernel\": \"%s\", \"unit\": \"ns\", \"count\": %zu, ", label, kernel, sum->count);
+	fprintf(out, "\"min\": %llu, \"median\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu, ",
+			sum->min, sum->median, sum->p90, sum->p99, sum->p999, sum->max);
+	fprintf(out, "\"mean\": %.1f, \"stddev\": %.1f, \"histogram\": [", sum->mean, sum->stddev);
+	int i, first = 1;
+	for (i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (h->counts[i] == 0) continue;
+		fprintf(out, "%s{\"low\": %llu, \"high\": %llu, \"count\": %llu}", first ? "" : ", ",
+				histogram_bucket_low(i), histogram_bucket_high(i), h->counts[i]);
+		first = 0;
+	}
+	fprintf(out, "]}\n");
+}
+
+void report(FILE* out, const char* label, samples* s, int format, int header) {
+	summary sum;
+	samples_summarize(s, &sum);
+
+	// the kernel release makes reports from different hosts comparable
+	struct utsname info;
+	const char* kernel = (uname(&info) == 0) ? info.release : "unknown";
+
+	if (format == FORMAT_CSV) {
+		print_csv(out, label, kernel, &sum, header);
+		return;
+	}
+
+	histogram* h = (histogram*)malloc(sizeof(histogram));
+	if (h == NULL) {
+		fprintf(stderr, "Cannot allocate memory for the histogram!\n");
+		exit(EXIT_FAILURE);
+	}
+	samples_histogram(s, h);
+	if (format == FORMAT_JSON)
+		print_json(out, label, kernel, &sum, h);
+	else
+		print_text(out, label, &sum, h);
+	free(h);
+}
+
+void report_counters(FILE* out, const char* label, counters* c, unsigned long iterations, int format) {
+	const char* source = c->rusage ? "getrusage" : "perf_event";
+	if (iterations == 0) iterations = 1;
+	int i;
+
+	if (format == FORMAT_CSV) {
+		fprintf(out, "label,counter,total,per_iteration\n");
+		for (i = 0; i < NUM_COUNTERS; i++) {
+			if (c->delta[i] < 0) continue;
+			fprintf(out, "%s,%s,%lld,%.1f\n", label, counter_name(i), c->delta[i],
+					(double)c->delta[i] / iterations);
+		}
+	} else if (format == FORMAT_JSON) {
+		fprintf(out, "{\"label\": \"%s\", \"iterations\": %lu, \"faults_source\": \"%s\", \"counters\": {",
+				label, iterations, source);
+		for (i = 0; i < NUM_COUNTERS; i++) {
+			fprintf(out, "%s\"%s\": ", i ? ", " : "", counter_name(i));
+			if (c->delta[i] < 0)
+				fprintf(out, "null");
+			else
+				fprintf(out, "{\"total\": %lld, \"per_iteration\": %.1f}", c->delta[i],
+						(double)c->delta[i] / iterations);
+		}
+		fprintf(out, "}}\n");
+	} else {
+		fprintf(out, "%s: counters per iteration (faults and switches from %s)\n", label, source);
+		for (i = 0; i < NUM_COUNTERS; i++) {
+			if (c->delta[i] < 0)
+				fprintf(out, "  %-18s n/a\n", counter_name(i));
+			else
+				fprintf(out, "  %-18s %14.1f\n", counter_name(i), (double)c->delta[i] / iterations);
+		}
+	}
+}
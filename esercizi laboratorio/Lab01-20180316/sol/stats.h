@@ -0,0 +1,76 @@
+#ifndef __STATS__
+#define __STATS__
+
+#include "performance.h"
+#include <stdio.h>
+
+/*
+ * Sample recorder for the benchmarks built on top of performance.h.
+ *
+ * Every measurement (in nanoseconds) is stored, so that the reports can
+ * show the whole distribution (min, median, tail percentiles, max) and
+ * not only the average. The first `warmup` samples are discarded: they
+ * usually pay for page faults, cold caches and lazy symbol binding.
+ */
+typedef struct {
+	unsigned long long* values;
+	size_t count;       // samples stored so far
+	size_t capacity;    // samples that can be stored
+	size_t warmup;      // samples still to be discarded
+} samples;
+
+typedef struct {
+	size_t count;
+	unsigned long long min;
+	unsigned long long median;
+	unsigned long long p90;
+	unsigned long long p99;
+	unsigned long long p999;
+	unsigned long long max;
+	double mean;
+	double stddev;
+} summary;
+
+/*
+ * HDR-style histogram: values below 2^HISTOGRAM_SUB_BITS get a bucket
+ * each, larger values are split in powers of two and each power of two
+ * in 2^HISTOGRAM_SUB_BITS linear sub-buckets, so that the relative
+ * error is the same (~3% with 5 bits) from nanoseconds to seconds.
+ */
+#define HISTOGRAM_SUB_BITS  5
+#define HISTOGRAM_BUCKETS   ((65 - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS)
+
+typedef struct {
+	unsigned long long counts[HISTOGRAM_BUCKETS];
+	unsigned long long total;
+} histogram;
+
+// output formats for the reports
+#define FORMAT_TEXT 0
+#define FORMAT_CSV  1
+#define FORMAT_JSON 2
+
+void samples_init(samples* s, size_t capacity, size_t warmup);
+void samples_add(samples* s, unsigned long long ns);
+void samples_free(samples* s);
+void samples_summarize(samples* s, summary* sum);
+void samples_histogram(samples* s, histogram* h);
+
+void histogram_add(histogram* h, unsigned long long value);
+unsigned long long histogram_bucket_low(int index);
+unsigned long long histogram_bucket_high(int index);
+
+int parse_format(const char* name);
+
+/*
+ * Writes the summary of s (and, for text and JSON, its histogram) to
+ * out using one of the FORMAT_* constants. In CSV mode a header line is
+ * printed only if header is non-zero, so that several reports can be
+ * appended to the same file.
+ */
+void report(FILE* out, const char* label, samples* s, int format, int header);
+
+// writes the counter deltas of a region made of the given iterations
+void report_counters(FILE* out, const char* label, counters* c, unsigned long iterations, int format);
+
+#endif
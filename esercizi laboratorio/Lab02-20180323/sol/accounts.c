@@ -0,0 +1,129 @@
+#include "accounts.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SPIN_LIMIT 1024
+
+static const char* account_lock_names[NUM_ACCOUNT_LOCKS] = { "striped", "account" };
+
+int parse_account_lock(const char* name) {
+	int i;
+	for (i = 0; i < NUM_ACCOUNT_LOCKS; i++)
+		if (strcmp(name, account_lock_names[i]) == 0) return i;
+	return -1;
+}
+
+const char* account_lock_name(int locking) {
+	return account_lock_names[locking];
+}
+
+int accounts_init(accounts_t* a, int num_accounts, long initial, int locking) {
+	memset(a, 0, sizeof(accounts_t));
+	a->num_accounts = num_accounts;
+	a->locking = locking;
+	a->balances = (long*)malloc(num_accounts * sizeof(long));
+	if (a->balances == NULL) return -1;
+	int i;
+	for (i = 0; i < num_accounts; i++)
+		a->balances[i] = initial;
+
+	if (locking == ACCOUNT_LOCK_STRIPED) {
+		a->stripes = (pthread_mutex_t*)malloc(ACCOUNT_STRIPES * sizeof(pthread_mutex_t));
+		if (a->stripes == NULL) return -1;
+		for (i = 0; i < ACCOUNT_STRIPES; i++)
+			pthread_mutex_init(&a->stripes[i], NULL);
+	} else {
+		a->account_locks = (int*)calloc(num_accounts, sizeof(int));
+		if (a->account_locks == NULL) return -1;
+	}
+	return 0;
+}
+
+void accounts_destroy(accounts_t* a) {
+	int i;
+	if (a->stripes != NULL) {
+		for (i = 0; i < ACCOUNT_STRIPES; i++)
+			pthread_mutex_destroy(&a->stripes[i]);
+		free(a->stripes);
+	}
+	free(a->account_locks);
+	free(a->balances);
+	memset(a, 0, sizeof(accounts_t));
+}
+
+static void spin_lock(int* lock) {
+	int spins = 0;
+	while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+			if (++spins == SPIN_LIMIT) {
+				spins = 0;
+				sched_yield();
+			}
+		}
+	}
+}
+
+static void spin_unlock(int* lock) {
+	__atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+// locks the two accounts (or their stripes) in increasing order
+static void lock_pair(accounts_t* a, int first, int second) {
+	if (a->locking == ACCOUNT_LOCK_STRIPED) {
+		first %= ACCOUNT_STRIPES;
+		second %= ACCOUNT_STRIPES;
+		if (first > second) { int tmp = first; first = second; second = tmp; }
+		pthread_mutex_lock(&a->stripes[first]);
+		if (second != first) pthread_mutex_lock(&a->stripes[second]);
+	} else {
+		if (first > second) { int tmp = first; first = second; second = tmp; }
+		spin_lock(&a->account_locks[first]);
+		if (second != first) spin_lock(&a->account_locks[second]);
+	}
+}
+
+static void unlock_pair(accounts_t* a, int first, int second) {
+	if (a->locking == ACCOUNT_LOCK_STRIPED) {
+		first %= ACCOUNT_STRIPES;
+		second %= ACCOUNT_STRIPES;
+		if (second != first) pthread_mutex_unlock(&a->stripes[second]);
+		pthread_mutex_unlock(&a->stripes[first]);
+	} else {
+		if (second != first) spin_unlock(&a->account_locks[second]);
+		spin_unlock(&a->account_locks[first]);
+	}
+}
+
+int accounts_transfer(accounts_t* a, int from, int to, long amount) {
+	int applied = 0;
+	lock_pair(a, from, to);
+	// only deposits run concurrently, and they can only add to from
+	if (__atomic_load_n(&a->balances[from], __ATOMIC_RELAXED) >= amount) {
+		__atomic_fetch_sub(&a->balances[from], amount, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&a->balances[to], amount, __ATOMIC_RELAXED);
+		applied = 1;
+	}
+	unlock_pair(a, from, to);
+	return applied;
+}
+
+int accounts_deposit(accounts_t* a, int to, long amount) {
+	long old = __atomic_load_n(&a->balances[to], __ATOMIC_RELAXED);
+	do {
+		if (old + amount > ACCOUNT_MAX_BALANCE) return 0;
+	} while (!__atomic_compare_exchange_n(&a->balances[to], &old, old + amount, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED)); // a failed CAS reloads old
+	return 1;
+}
+
+long accounts_total(accounts_t* a) {
+	long total = 0;
+	int i;
+	for (i = 0; i < a->num_accounts; i++)
+		total += a->balances[i];
+	return total;
+}
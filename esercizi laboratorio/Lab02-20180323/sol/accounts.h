@@ -0,0 +1,52 @@
+#ifndef __ACCOUNTS__
+#define __ACCOUNTS__
+
+#include <pthread.h>
+
+/*
+ * Table of accounts for the transfers simulator, the many-accounts
+ * version of the single deposit of producer_consumer.c.
+ *
+ * A transfer locks both accounts, always in increasing order so that
+ * two opposite transfers cannot deadlock, checks the funds and moves
+ * the amount. Locks are either striped (ACCOUNT_STRIPES mutexes, the
+ * account picks one by its index) or one test-and-test-and-set
+ * spinlock per account.
+ *
+ * A deposit touches a single account and takes no lock: it reads the
+ * balance, checks it against ACCOUNT_MAX_BALANCE and installs the new
+ * one with a compare-and-swap, retrying if another deposit or a
+ * transfer got there first. Transfers therefore update the balances
+ * with atomic adds too; since a concurrent deposit can only increase a
+ * balance, the funds check done under the locks stays valid.
+ */
+#define ACCOUNT_LOCK_STRIPED    0
+#define ACCOUNT_LOCK_ACCOUNT    1
+#define NUM_ACCOUNT_LOCKS       2
+
+#define ACCOUNT_STRIPES         1024
+#define ACCOUNT_MAX_BALANCE     (1L << 40)
+
+typedef struct {
+	long* balances;
+	int num_accounts;
+	int locking;
+	pthread_mutex_t* stripes;   // ACCOUNT_LOCK_STRIPED
+	int* account_locks;         // ACCOUNT_LOCK_ACCOUNT, 0 free 1 taken
+} accounts_t;
+
+int parse_account_lock(const char* name);
+const char* account_lock_name(int locking);
+
+// returns 0 on success
+int accounts_init(accounts_t* a, int num_accounts, long initial, int locking);
+void accounts_destroy(accounts_t* a);
+
+// return 1 if applied, 0 if rejected (insufficient funds, balance limit)
+int accounts_transfer(accounts_t* a, int from, int to, long amount);
+int accounts_deposit(accounts_t* a, int to, long amount);
+
+// sum of all the balances, to be called when nobody is updating them
+long accounts_total(accounts_t* a);
+
+#endif
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE     // CPU_SET and pthread_setaffinity_np()
+#include "affinity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MAX_NODES 64
+
+static const char* placement_names[] = { "none", "compact", "scatter", "node" };
+
+static int num_nodes = 0;
+static int node_size[MAX_NODES];
+static int* node_cpus[MAX_NODES];   // CPUs of every node, in increasing order
+static int num_cpus = 0;
+
+int parse_placement(const char* name) {
+	int i;
+	for (i = 0; i <= PLACEMENT_NODE; i++)
+		if (strcmp(name, placement_names[i]) == 0) return i;
+	return -1;
+}
+
+const char* placement_name(int placement) {
+	return placement_names[placement];
+}
+
+// parses a cpulist such as "0-3,8-11" keeping only the CPUs in allowed
+static int parse_cpulist(const char* list, cpu_set_t* allowed, int* cpus) {
+	int count = 0;
+	const char* p = list;
+	while (*p && *p != '\n') {
+		char* next;
+		int first = (int)strtol(p, &next, 10), last = first, cpu;
+		if (next == p) break;
+		if (*next == '-') last = (int)strtol(next + 1, &next, 10);
+		for (cpu = first; cpu <= last; cpu++)
+			if (CPU_ISSET(cpu, allowed)) cpus[count++] = cpu;
+		p = (*next == ',') ? next + 1 : next;
+	}
+	return count;
+}
+
+void placement_init() {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		fprintf(stderr, "Can't read the CPU affinity mask\n");
+		exit(EXIT_FAILURE);
+	}
+
+	int node;
+	num_nodes = 0;
+	for (node = 0; node < MAX_NODES; node++) {
+		char path[64], list[4096];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		FILE* fp = fopen(path, "r");
+		if (fp == NULL) continue;
+		if (fgets(list, sizeof(list), fp) != NULL) {
+			int* cpus = (int*)malloc(CPU_SETSIZE * sizeof(int));
+			int count = parse_cpulist(list, &allowed, cpus);
+			if (count > 0) {
+				node_cpus[num_nodes] = cpus;
+				node_size[num_nodes++] = count;
+			} else {
+				free(cpus); // memory-only node or no allowed CPU
+			}
+		}
+		fclose(fp);
+	}
+
+	if (num_nodes == 0) {
+		// no NUMA information: a single node with every allowed CPU
+		int cpu, count = 0;
+		node_cpus[0] = (int*)malloc(CPU_SETSIZE * sizeof(int));
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &allowed)) node_cpus[0][count++] = cpu;
+		node_size[0] = count;
+		num_nodes = 1;
+	}
+
+	num_cpus = 0;
+	for (node = 0; node < num_nodes; node++)
+		num_cpus += node_size[node];
+}
+
+int online_cpus() {
+	return num_cpus;
+}
+
+int numa_nodes() {
+	return num_nodes;
+}
+
+int place_thread(int placement, int index) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	int node, result, i;
+
+	switch (placement) {
+	case PLACEMENT_COMPACT:
+		index %= num_cpus;
+		for (node = 0; index >= node_size[node]; node++)
+			index -= node_size[node];
+		result = node_cpus[node][index];
+		CPU_SET(result, &set);
+		break;
+	case PLACEMENT_SCATTER:
+		node = index % num_nodes;
+		result = node_cpus[node][(index / num_nodes) % node_size[node]];
+		CPU_SET(result, &set);
+		break;
+	case PLACEMENT_NODE:
+		result = index % num_nodes;
+		for (i = 0; i < node_size[result]; i++)
+			CPU_SET(node_cpus[result][i], &set);
+		break;
+	default:
+		return -1;
+	}
+
+	int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		fprintf(stderr, "Can't set the affinity of thread %d, error %d\n", index, ret);
+		exit(EXIT_FAILURE);
+	}
+	return result;
+}
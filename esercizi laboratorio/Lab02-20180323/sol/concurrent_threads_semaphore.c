@@ -1,63 +1,238 @@
 #include "performance.h"
+#include "affinity.h"
+#include "locks.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include <errno.h>
 
 #define N 1000 // number of threads
 #define M 10000 // number of iterations per thread
 #define V 1 // value added to the balance by each thread at each iteration
 
-sem_t sem;
+/*
+ * With -p compact|scatter|node each thread is pinned before starting
+ * its adds (see affinity.h), -C caps the number of threads at the
+ * number of online CPUs and -s prints a scaling curve: the throughput
+ * with 1, 2, 4, ... n threads.
+ *
+ * The critical section can be guarded by any backend of locks.h
+ * (-l sem|mutex|adaptive|spin|ticket|mcs|clh|atomic, sem by default).
+ * With -b every backend runs for DURATION milliseconds (-d to change
+ * it) with 1, 2, 4, ... n threads, and we report the throughput and
+ * how evenly the operations were spread among the threads: min and max
+ * per-thread counts and Jain's fairness index (1 means perfectly fair,
+ * 1/threads means a single thread did all the work).
+ */
+
+#define DURATION 200 // milliseconds per configuration in benchmark mode
+
+lock_t lock;
 unsigned long int shared_variable;
 int n = N, m = M, v = V;
+int placement = PLACEMENT_NONE;
+int duration = DURATION;
+
+// per-thread operation counts, one cache line each
+typedef struct {
+	unsigned long int ops;
+} __attribute__((aligned(CACHE_LINE_SIZE))) thread_result_t;
+
+thread_result_t* results;
+atomic_int started, stop;
+
+static inline int locked_add(lock_node_t* node) {
+	if (lock.kind == LOCK_ATOMIC) {
+		__atomic_fetch_add(&shared_variable, v, __ATOMIC_RELAXED);
+		return 0;
+	}
+	int ret = lock_acquire(&lock, node);
+	if (ret != 0) {
+		fprintf(stderr, "Can't lock the %s lock, error %d\n", lock_name(lock.kind), ret);
+		return -1;
+	}
+	
+	shared_variable += v;
+	
+	ret = lock_release(&lock, node);
+	if (ret != 0) {
+		fprintf(stderr, "Can't unlock the %s lock, error %d\n", lock_name(lock.kind), ret);
+		return -1;
+	}
+	return 0;
+}
 
 void* thread_work(void *arg) {
 	int i;
-	for (i = 0; i < m; i++) {
-		if (sem_wait(&sem) != 0) {
-			fprintf(stderr, "Can't lock the semaphore, error %d\n", errno);
-			return NULL;
+	lock_node_t node;
+	lock_node_init(&node);
+	place_thread(placement, *((int*)arg));
+	for (i = 0; i < m; i++)
+		if (locked_add(&node) != 0) break;
+	lock_node_destroy(&node);
+	return NULL;
+}
+
+// benchmark mode: add until main raises stop, counting our operations
+void* bench_work(void *arg) {
+	int idx = *((int*)arg);
+	unsigned long int ops = 0;
+	lock_node_t node;
+	lock_node_init(&node);
+	place_thread(placement, idx);
+	atomic_fetch_add(&started, 1);
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (locked_add(&node) != 0) break;
+		ops++;
+	}
+	results[idx].ops = ops;
+	lock_node_destroy(&node);
+	return NULL;
+}
+
+/*
+ * Runs threads threads and measures the time until the last join. In
+ * benchmark mode the clock starts once every thread is running and
+ * the threads are stopped after duration milliseconds.
+ */
+void run(int threads, timer* t, int bench) {
+	pthread_t* handles = (pthread_t*)malloc(threads * sizeof(pthread_t));
+	int* thread_ids = (int*)malloc(threads * sizeof(int));
+	int i;
+	shared_variable = 0;
+	atomic_store(&started, 0);
+	atomic_store(&stop, 0);
+	if (!bench) begin(t);
+	for (i = 0; i < threads; i++) {
+		thread_ids[i] = i;
+		if (pthread_create(&handles[i], NULL, bench ? bench_work : thread_work, &thread_ids[i]) != 0) {
+			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (bench) {
+		while (atomic_load(&started) < threads)
+			sched_yield();
+		begin(t);
+		struct timespec pause = { duration / 1000, (duration % 1000) * 1000000L };
+		nanosleep(&pause, NULL);
+		atomic_store(&stop, 1);
+	}
+	for (i = 0; i < threads; i++)
+		pthread_join(handles[i], NULL);
+	end(t);
+	free(handles);
+	free(thread_ids);
+}
+
+void scaling_curve() {
+	int threads;
+	printf("Placement %s, %d CPUs on %d NUMA nodes, %s lock\n", placement_name(placement), online_cpus(), numa_nodes(), lock_name(lock.kind));
+	printf("%8s %12s %10s\n", "threads", "Mops/s", "ms");
+	for (threads = 1; ; threads = (threads * 2 > n && threads < n) ? n : threads * 2) {
+		timer t;
+		run(threads, &t, 0);
+		if (shared_variable != (unsigned long int)threads*m*v) {
+			fprintf(stderr, "Lost adds with %d threads!\n", threads);
+			exit(EXIT_FAILURE);
 		}
-		
-		shared_variable += v;
-		
-		if (sem_post(&sem) != 0) {
-			fprintf(stderr, "Can't unlock the semaphore, error %d\n", errno);
-			return NULL;
+		printf("%8d %12.3f %10llu\n", threads, (double)threads * m / get_nanoseconds(&t) * 1e3, get_milliseconds(&t));
+		fflush(stdout);
+		if (threads >= n) break;
+	}
+}
+
+void benchmark() {
+	int kind, threads, i;
+	printf("Placement %s, %d CPUs on %d NUMA nodes, %d ms per run\n", placement_name(placement),
+			online_cpus(), numa_nodes(), duration);
+	printf("%-9s %8s %12s %12s %12s %9s\n", "lock", "threads", "Mops/s", "min ops", "max ops", "fairness");
+	results = (thread_result_t*)aligned_alloc(CACHE_LINE_SIZE, n * sizeof(thread_result_t));
+	if (results == NULL) {
+		fprintf(stderr, "Can't allocate the results of %d threads\n", n);
+		exit(EXIT_FAILURE);
+	}
+	for (kind = 0; kind < NUM_LOCKS; kind++) {
+		lock_init(&lock, kind);
+		for (threads = 1; ; threads = (threads * 2 > n && threads < n) ? n : threads * 2) {
+			timer t;
+			run(threads, &t, 1);
+
+			unsigned long int total = 0, min_ops = ~0UL, max_ops = 0;
+			double squares = 0;
+			for (i = 0; i < threads; i++) {
+				unsigned long int ops = results[i].ops;
+				total += ops;
+				squares += (double)ops * ops;
+				if (ops < min_ops) min_ops = ops;
+				if (ops > max_ops) max_ops = ops;
+			}
+			if (shared_variable != total * v) {
+				fprintf(stderr, "Lock %s lost adds with %d threads!\n", lock_name(kind), threads);
+				exit(EXIT_FAILURE);
+			}
+			double fairness = squares > 0 ? (double)total * total / (threads * squares) : 0;
+			printf("%-9s %8d %12.3f %12lu %12lu %9.3f\n", lock_name(kind), threads,
+					(double)total / get_nanoseconds(&t) * 1e3, min_ops, max_ops, fairness);
+			fflush(stdout);
+			if (threads >= n) break;
 		}
+		lock_destroy(&lock);
 	}
-	return NULL;
+	free(results);
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s [-p none|compact|scatter|node] [-C] [-s] "
+			"[-l sem|mutex|adaptive|spin|ticket|mcs|clh|atomic] [-b [-d <ms>]] [<n> [<m> [<v>]]]\n", prog);
+	exit(EXIT_FAILURE);
 }
 
 int main(int argc, char **argv)
 {
-	if (argc > 1) n = atoi(argv[1]);
-	if (argc > 2) m = atoi(argv[2]);
-	if (argc > 3) v = atoi(argv[3]);
-	shared_variable = 0;
+	int cap = 0, sweep = 0, bench = 0, kind = LOCK_SEM, opt;
+	while ((opt = getopt(argc, argv, "p:Csl:bd:")) != -1) {
+		switch (opt) {
+		case 'p':
+			placement = parse_placement(optarg);
+			if (placement < 0) usage(argv[0]);
+			break;
+		case 'C': cap = 1; break;
+		case 's': sweep = 1; break;
+		case 'b': bench = 1; break;
+		case 'd': duration = atoi(optarg); break;
+		case 'l':
+			kind = parse_lock(optarg);
+			if (kind < 0) usage(argv[0]);
+			break;
+		default: usage(argv[0]);
+		}
+	}
+	if (argc > optind) n = atoi(argv[optind]);
+	if (argc > optind + 1) m = atoi(argv[optind + 1]);
+	if (argc > optind + 2) v = atoi(argv[optind + 2]);
+	placement_init();
+	if (cap && n > online_cpus()) n = online_cpus();
 	timer t;
 	
-	printf("Going to start %d threads, each adding %d times %d to a shared variable initialized to zero...", n, m, v); fflush(stdout);
-	pthread_t* threads = (pthread_t*)malloc(n * sizeof(pthread_t));
-	int i;
-	if (sem_init(&sem, 0, 1) != 0) {
-		fprintf(stderr, "Can't initialize the semaphore, error %d\n", errno);
-		exit(EXIT_FAILURE);
+	if (bench) {
+		benchmark();
+		return EXIT_SUCCESS;
 	}
-	begin(&t);
-	for (i = 0; i < n; i++)
-		if (pthread_create(&threads[i], NULL, thread_work, NULL) != 0) {
-			fprintf(stderr, "Can't create a new thread, error %d\n", errno);
-			exit(EXIT_FAILURE);
-		}
-	printf("ok\n");
-		
-	printf("Waiting for the termination of all the %d threads...", n); fflush(stdout);
-	for (i = 0; i < n; i++)
-		pthread_join(threads[i], NULL);
-	end(&t);
+	lock_init(&lock, kind);
+	if (sweep) {
+		scaling_curve();
+		lock_destroy(&lock);
+		return EXIT_SUCCESS;
+	}
+
+	printf("Going to start %d threads, each adding %d times %d to a shared variable initialized to zero (%s lock)...", n, m, v, lock_name(kind)); fflush(stdout);
+	run(n, &t, 0);
 	printf("ok\n");
 	
 	unsigned long int expected_value = (unsigned long int)n*m*v;
@@ -66,9 +241,8 @@ int main(int argc, char **argv)
 		unsigned long int lost_adds = (expected_value - shared_variable) / v;
 		printf("Number of lost adds: %lu\n", lost_adds);
 	}
-	printf("It took %lu milliseconds\n", get_milliseconds(&t));
+	printf("It took %llu milliseconds\n", get_milliseconds(&t));
 	
-	free(threads);
-	sem_destroy(&sem);
+	lock_destroy(&lock);
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,186 @@
+#include "ledger.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define REPLAY_CHUNK 1024
+
+int ledger_replay(const char* path, long* sum, unsigned long* count) {
+	*sum = 0;
+	*count = 0;
+	int fd = open(path, O_RDWR);
+	if (fd == -1) return (errno == ENOENT) ? 0 : -1;
+
+	ledger_record_t records[REPLAY_CHUNK];
+	off_t valid = 0;
+	ssize_t bytes;
+	int torn = 0;
+	while (!torn && (bytes = read(fd, records, sizeof(records))) > 0) {
+		size_t i, n = bytes / sizeof(ledger_record_t);
+		for (i = 0; i < n; i++) {
+			if (records[i].check != (~(unsigned int)records[i].value ^ LEDGER_MAGIC)) {
+				torn = 1;
+				break;
+			}
+			*sum += records[i].value;
+			++*count;
+			valid += sizeof(ledger_record_t);
+		}
+		if (n * sizeof(ledger_record_t) != (size_t)bytes) torn = 1; // partial record
+	}
+	if (bytes < 0 || ftruncate(fd, valid)) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+static void write_all(int fd, const void* data, size_t size) {
+	const char* p = (const char*)data;
+	while (size > 0) {
+		ssize_t written = write(fd, p, size);
+		if (written == -1) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Ledger write error: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		p += written;
+		size -= written;
+	}
+}
+
+static void* commit_thread(void* arg) {
+	ledger_t* l = (ledger_t*)arg;
+	pthread_mutex_lock(&l->lock);
+	while (1) {
+		while (l->count == 0 && !l->shutdown)
+			pthread_cond_wait(&l->pending, &l->lock);
+		if (l->count == 0) break; // shutdown and nothing left
+
+		// group commit: give the other appenders up to budget_ns to join
+		if (l->budget_ns > 0) {
+			struct timespec deadline;
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			deadline.tv_sec += l->budget_ns / 1000000000;
+			deadline.tv_nsec += l->budget_ns % 1000000000;
+			if (deadline.tv_nsec >= 1000000000) {
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000;
+			}
+			while (l->count < LEDGER_BUFFER / 2 && !l->shutdown)
+				if (pthread_cond_timedwait(&l->pending, &l->lock, &deadline) == ETIMEDOUT) break;
+		}
+
+		// take the buffer, appenders go on with the other one
+		ledger_record_t* group = l->buffer;
+		size_t count = l->count;
+		unsigned long last = l->appended;
+		l->buffer = l->spare;
+		l->spare = group;
+		l->count = 0;
+		pthread_cond_broadcast(&l->space);
+		pthread_mutex_unlock(&l->lock);
+
+		write_all(l->fd, group, count * sizeof(ledger_record_t));
+		if (fdatasync(l->fd)) {
+			fprintf(stderr, "Ledger fdatasync error: %s\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+
+		pthread_mutex_lock(&l->lock);
+		__atomic_store_n(&l->durable, last, __ATOMIC_RELEASE);
+		l->syncs++;
+		pthread_cond_broadcast(&l->committed);
+	}
+	pthread_mutex_unlock(&l->lock);
+	return NULL;
+}
+
+int ledger_open(ledger_t* l, const char* path, long budget_us) {
+	memset(l, 0, sizeof(ledger_t));
+	l->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (l->fd == -1) return -1;
+	l->budget_ns = budget_us * 1000;
+	l->buffer = (ledger_record_t*)malloc(LEDGER_BUFFER * sizeof(ledger_record_t));
+	l->spare = (ledger_record_t*)malloc(LEDGER_BUFFER * sizeof(ledger_record_t));
+	if (l->buffer == NULL || l->spare == NULL) {
+		free(l->buffer); // free(NULL) does nothing
+		free(l->spare);
+		close(l->fd);
+		return -1;
+	}
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC); // for the budget
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_cond_init(&l->pending, &attr);
+	pthread_cond_init(&l->space, NULL);
+	pthread_cond_init(&l->committed, NULL);
+	pthread_condattr_destroy(&attr);
+
+	if (pthread_create(&l->committer, NULL, commit_thread, l)) {
+		pthread_mutex_destroy(&l->lock);
+		pthread_cond_destroy(&l->pending);
+		pthread_cond_destroy(&l->space);
+		pthread_cond_destroy(&l->committed);
+		free(l->buffer);
+		free(l->spare);
+		close(l->fd);
+		return -1;
+	}
+	return 0;
+}
+
+unsigned long ledger_append_batch(ledger_t* l, const int* values, size_t count) {
+	size_t i;
+	pthread_mutex_lock(&l->lock);
+	for (i = 0; i < count; i++) {
+		while (l->count == LEDGER_BUFFER) // the commit thread is behind
+			pthread_cond_wait(&l->space, &l->lock);
+		l->buffer[l->count].value = values[i];
+		l->buffer[l->count].check = ~(unsigned int)values[i] ^ LEDGER_MAGIC;
+		if (++l->count == 1 || l->count == LEDGER_BUFFER / 2)
+			pthread_cond_signal(&l->pending); // first record, or worth a flush
+		l->appended++;
+	}
+	unsigned long seq = l->appended;
+	pthread_mutex_unlock(&l->lock);
+	return seq;
+}
+
+unsigned long ledger_append(ledger_t* l, int value) {
+	return ledger_append_batch(l, &value, 1);
+}
+
+unsigned long ledger_durable(ledger_t* l) {
+	return __atomic_load_n(&l->durable, __ATOMIC_ACQUIRE);
+}
+
+void ledger_wait(ledger_t* l, unsigned long seq) {
+	pthread_mutex_lock(&l->lock);
+	while (l->durable < seq)
+		pthread_cond_wait(&l->committed, &l->lock);
+	pthread_mutex_unlock(&l->lock);
+}
+
+void ledger_close(ledger_t* l) {
+	pthread_mutex_lock(&l->lock);
+	l->shutdown = 1;
+	pthread_cond_signal(&l->pending);
+	pthread_mutex_unlock(&l->lock);
+	pthread_join(l->committer, NULL);
+
+	close(l->fd);
+	pthread_mutex_destroy(&l->lock);
+	pthread_cond_destroy(&l->pending);
+	pthread_cond_destroy(&l->space);
+	pthread_cond_destroy(&l->committed);
+	free(l->buffer);
+	free(l->spare);
+}
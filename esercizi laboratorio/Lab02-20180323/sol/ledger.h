@@ -0,0 +1,73 @@
+#ifndef __LEDGER__
+#define __LEDGER__
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*
+ * Durable write-ahead log of transactions with group commit.
+ *
+ * ledger_append() only copies the transaction in a memory buffer and
+ * returns its sequence number: it never waits for the disk. A commit
+ * thread takes the whole buffer (appenders go on filling a second one),
+ * writes it with a single write() and makes it durable with a single
+ * fdatasync(), then acknowledges every sequence number up to the last
+ * one it wrote. After the first record of a group arrives the commit
+ * thread waits up to the latency budget for more records (or until
+ * half of the buffer is full), so that one fdatasync() covers many
+ * transactions. Appenders learn about durability asynchronously with
+ * ledger_durable(), or block with ledger_wait() when they need to.
+ *
+ * Every record carries a check word, so that a torn record at the end
+ * of the file (a crash in the middle of a write) is detected and cut
+ * away by ledger_replay().
+ */
+#define LEDGER_BUFFER   4096    // records per buffer
+#define LEDGER_MAGIC    0x4C444752U
+
+typedef struct {
+	int value;
+	unsigned int check;     // ~value ^ LEDGER_MAGIC
+} ledger_record_t;
+
+typedef struct {
+	int fd;
+	long budget_ns;
+	pthread_mutex_t lock;
+	pthread_cond_t pending;     // signalled to the commit thread
+	pthread_cond_t space;       // signalled to appenders waiting for a buffer
+	pthread_cond_t committed;   // signalled to ledger_wait()
+	ledger_record_t* buffer;    // being filled by the appenders
+	ledger_record_t* spare;     // being written by the commit thread
+	size_t count;
+	unsigned long appended;     // last sequence number given out
+	unsigned long durable;      // last sequence number on disk
+	unsigned long syncs;
+	int shutdown;
+	pthread_t committer;
+} ledger_t;
+
+/*
+ * Reads the log at path (a missing file is an empty log), truncates a
+ * torn tail and returns the sum and the number of the valid records.
+ * Returns 0 on success, -1 on I/O errors.
+ */
+int ledger_replay(const char* path, long* sum, unsigned long* count);
+
+// opens path for appending and starts the commit thread; 0 on success
+int ledger_open(ledger_t* l, const char* path, long budget_us);
+
+// returns the sequence number of the (last) record appended
+unsigned long ledger_append(ledger_t* l, int value);
+unsigned long ledger_append_batch(ledger_t* l, const int* values, size_t count);
+
+// last sequence number known to be durable
+unsigned long ledger_durable(ledger_t* l);
+
+// blocks until seq is durable
+void ledger_wait(ledger_t* l, unsigned long seq);
+
+// commits what is left, stops the commit thread and closes the file
+void ledger_close(ledger_t* l);
+
+#endif
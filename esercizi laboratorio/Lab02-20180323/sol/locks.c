@@ -0,0 +1,180 @@
+#define _GNU_SOURCE     // PTHREAD_MUTEX_ADAPTIVE_NP
+#include "locks.h"
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* lock_names[NUM_LOCKS] = {
+	"sem", "mutex", "adaptive", "spin", "ticket", "mcs", "clh", "atomic"
+};
+
+static inline void cpu_relax(int* spins) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+	if (++(*spins) == SPIN_LIMIT) {
+		*spins = 0;
+		sched_yield();
+	}
+}
+
+int parse_lock(const char* name) {
+	int i;
+	for (i = 0; i < NUM_LOCKS; i++)
+		if (strcmp(name, lock_names[i]) == 0) return i;
+	return -1;
+}
+
+const char* lock_name(int kind) {
+	return lock_names[kind];
+}
+
+static clh_node_t* clh_node_alloc() {
+	clh_node_t* node;
+	if (posix_memalign((void**)&node, CACHE_LINE_SIZE, sizeof(clh_node_t)) != 0) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	atomic_init(&node->locked, 0);
+	return node;
+}
+
+void lock_init(lock_t* lock, int kind) {
+	memset(lock, 0, sizeof(lock_t));
+	lock->kind = kind;
+	int ret = 0;
+	switch (kind) {
+	case LOCK_SEM:
+		ret = sem_init(&lock->sem, 0, 1);
+		break;
+	case LOCK_MUTEX:
+		ret = pthread_mutex_init(&lock->mutex, NULL);
+		break;
+	case LOCK_ADAPTIVE: {
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+		ret = pthread_mutex_init(&lock->mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		break;
+	}
+	case LOCK_SPIN:
+		ret = pthread_spin_init(&lock->spin, PTHREAD_PROCESS_PRIVATE);
+		break;
+	case LOCK_TICKET:
+		atomic_init(&lock->ticket_next, 0);
+		atomic_init(&lock->ticket_owner, 0);
+		break;
+	case LOCK_MCS:
+		atomic_init(&lock->mcs_tail, NULL);
+		break;
+	case LOCK_CLH:
+		atomic_init(&lock->clh_tail, clh_node_alloc()); // unlocked dummy node
+		break;
+	}
+	if (ret != 0) {
+		fprintf(stderr, "Can't initialize the %s lock, error %d\n", lock_names[kind], ret);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void lock_destroy(lock_t* lock) {
+	switch (lock->kind) {
+	case LOCK_SEM: sem_destroy(&lock->sem); break;
+	case LOCK_MUTEX:
+	case LOCK_ADAPTIVE: pthread_mutex_destroy(&lock->mutex); break;
+	case LOCK_SPIN: pthread_spin_destroy(&lock->spin); break;
+	case LOCK_CLH: free(atomic_load(&lock->clh_tail)); break; // owned by nobody
+	}
+}
+
+void lock_node_init(lock_node_t* node) {
+	atomic_init(&node->mcs.next, NULL);
+	atomic_init(&node->mcs.locked, 0);
+	node->clh = clh_node_alloc();
+	node->clh_pred = NULL;
+}
+
+void lock_node_destroy(lock_node_t* node) {
+	free(node->clh);
+}
+
+int lock_acquire(lock_t* lock, lock_node_t* node) {
+	int spins = 0;
+	switch (lock->kind) {
+	case LOCK_SEM:
+		return sem_wait(&lock->sem) ? errno : 0;
+	case LOCK_MUTEX:
+	case LOCK_ADAPTIVE:
+		return pthread_mutex_lock(&lock->mutex);
+	case LOCK_SPIN:
+		return pthread_spin_lock(&lock->spin);
+	case LOCK_TICKET: {
+		unsigned int ticket = atomic_fetch_add_explicit(&lock->ticket_next, 1, memory_order_relaxed);
+		while (atomic_load_explicit(&lock->ticket_owner, memory_order_acquire) != ticket)
+			cpu_relax(&spins);
+		return 0;
+	}
+	case LOCK_MCS: {
+		mcs_node_t* me = &node->mcs;
+		atomic_store_explicit(&me->next, NULL, memory_order_relaxed);
+		atomic_store_explicit(&me->locked, 1, memory_order_relaxed);
+		mcs_node_t* pred = atomic_exchange_explicit(&lock->mcs_tail, me, memory_order_acq_rel);
+		if (pred != NULL) {
+			atomic_store_explicit(&pred->next, me, memory_order_release);
+			while (atomic_load_explicit(&me->locked, memory_order_acquire))
+				cpu_relax(&spins);
+		}
+		return 0;
+	}
+	case LOCK_CLH: {
+		atomic_store_explicit(&node->clh->locked, 1, memory_order_relaxed);
+		clh_node_t* pred = atomic_exchange_explicit(&lock->clh_tail, node->clh, memory_order_acq_rel);
+		while (atomic_load_explicit(&pred->locked, memory_order_acquire))
+			cpu_relax(&spins);
+		node->clh_pred = pred;
+		return 0;
+	}
+	}
+	return 0;
+}
+
+int lock_release(lock_t* lock, lock_node_t* node) {
+	int spins = 0;
+	switch (lock->kind) {
+	case LOCK_SEM:
+		return sem_post(&lock->sem) ? errno : 0;
+	case LOCK_MUTEX:
+	case LOCK_ADAPTIVE:
+		return pthread_mutex_unlock(&lock->mutex);
+	case LOCK_SPIN:
+		return pthread_spin_unlock(&lock->spin);
+	case LOCK_TICKET:
+		atomic_fetch_add_explicit(&lock->ticket_owner, 1, memory_order_release);
+		return 0;
+	case LOCK_MCS: {
+		mcs_node_t* me = &node->mcs;
+		mcs_node_t* next = atomic_load_explicit(&me->next, memory_order_acquire);
+		if (next == NULL) {
+			mcs_node_t* expected = me;
+			if (atomic_compare_exchange_strong_explicit(&lock->mcs_tail, &expected, NULL,
+					memory_order_acq_rel, memory_order_acquire))
+				return 0; // nobody waiting
+			// a successor is enqueuing itself: wait for the link
+			while ((next = atomic_load_explicit(&me->next, memory_order_acquire)) == NULL)
+				cpu_relax(&spins);
+		}
+		atomic_store_explicit(&next->locked, 0, memory_order_release);
+		return 0;
+	}
+	case LOCK_CLH: {
+		clh_node_t* mine = node->clh;
+		node->clh = node->clh_pred; // the successor still spins on mine
+		atomic_store_explicit(&mine->locked, 0, memory_order_release);
+		return 0;
+	}
+	}
+	return 0;
+}
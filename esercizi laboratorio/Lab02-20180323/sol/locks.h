@@ -0,0 +1,73 @@
+#ifndef __LOCKS__
+#define __LOCKS__
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+
+/*
+ * Interchangeable locks for protecting a short critical section:
+ *  - sem:      a sem_t initialized to 1 (the original solution);
+ *  - mutex:    a default pthread mutex;
+ *  - adaptive: a PTHREAD_MUTEX_ADAPTIVE_NP mutex (spins before sleeping);
+ *  - spin:     a pthread spinlock;
+ *  - ticket:   FIFO ticket lock (fetch_add on next, spin on owner);
+ *  - mcs:      MCS queue lock, each waiter spins on its own node;
+ *  - clh:      CLH queue lock, each waiter spins on its predecessor;
+ *  - atomic:   no lock at all, callers use an atomic add instead.
+ * The spinning locks call sched_yield() after SPIN_LIMIT attempts, so
+ * that they still make progress when there are more threads than CPUs.
+ */
+#define LOCK_SEM        0
+#define LOCK_MUTEX      1
+#define LOCK_ADAPTIVE   2
+#define LOCK_SPIN       3
+#define LOCK_TICKET     4
+#define LOCK_MCS        5
+#define LOCK_CLH        6
+#define LOCK_ATOMIC     7
+#define NUM_LOCKS       8
+
+#define CACHE_LINE_SIZE 64
+#define SPIN_LIMIT      1024
+
+typedef struct mcs_node_s {
+	_Atomic(struct mcs_node_s*) next;
+	atomic_int locked;
+} __attribute__((aligned(CACHE_LINE_SIZE))) mcs_node_t;
+
+typedef struct clh_node_s {
+	atomic_int locked;
+} __attribute__((aligned(CACHE_LINE_SIZE))) clh_node_t;
+
+// per-thread state required by the queue locks
+typedef struct {
+	mcs_node_t mcs;
+	clh_node_t* clh;        // node enqueued by this thread
+	clh_node_t* clh_pred;   // node of the predecessor, recycled on release
+} lock_node_t;
+
+typedef struct {
+	int kind;
+	sem_t sem;
+	pthread_mutex_t mutex;
+	pthread_spinlock_t spin;
+	atomic_uint ticket_next __attribute__((aligned(CACHE_LINE_SIZE)));
+	atomic_uint ticket_owner __attribute__((aligned(CACHE_LINE_SIZE)));
+	_Atomic(mcs_node_t*) mcs_tail __attribute__((aligned(CACHE_LINE_SIZE)));
+	_Atomic(clh_node_t*) clh_tail __attribute__((aligned(CACHE_LINE_SIZE)));
+} lock_t;
+
+int parse_lock(const char* name);
+const char* lock_name(int kind);
+
+void lock_init(lock_t* lock, int kind);
+void lock_destroy(lock_t* lock);
+void lock_node_init(lock_node_t* node);
+void lock_node_destroy(lock_node_t* node);
+
+// both return 0 on success or an error number, as the pthread calls do
+int lock_acquire(lock_t* lock, lock_node_t* node);
+int lock_release(lock_t* lock, lock_node_t* node);
+
+#endif
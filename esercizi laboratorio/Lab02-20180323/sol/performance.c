@@ -1,40 +1,123 @@
 #include "performance.h"
-#include <math.h>
-
-struct timespec diff(struct timespec start, struct timespec end)
-{
-	struct timespec temp;
-	if (end.tv_nsec - start.tv_nsec < 0) {
-		temp.tv_sec = end.tv_sec - start.tv_sec-1;
-		temp.tv_nsec = 1000000000 + end.tv_nsec-start.tv_nsec;
-	} else {
-		temp.tv_sec = end.tv_sec - start.tv_sec;
-		temp.tv_nsec = end.tv_nsec - start.tv_nsec;
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+static int source = TIMER_CLOCK;
+static double ns_per_tick = 1.0;
+
+static unsigned long long clock_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#ifdef HAVE_TSC
+// the lfence keeps the region from starting before rdtsc
+static inline unsigned long long tsc_begin(void) {
+	_mm_lfence();
+	unsigned long long ticks = __rdtsc();
+	_mm_lfence();
+	return ticks;
+}
+
+// rdtscp waits for the region to complete, the lfence for rdtscp
+static inline unsigned long long tsc_end(void) {
+	unsigned int aux;
+	unsigned long long ticks = __rdtscp(&aux);
+	_mm_lfence();
+	return ticks;
+}
+
+// invariant TSC: CPUID.80000007H:EDX[8], rdtscp: CPUID.80000001H:EDX[27]
+static int tsc_invariant(void) {
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007) return 0;
+	__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx);
+	if (!(edx & (1 << 27))) return 0;
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+
+// ticks per nanosecond over a 20 ms window, best of three
+static double tsc_calibrate(void) {
+	struct timespec pause = { 0, 20000000 };
+	double best = 0;
+	int i;
+	for (i = 0; i < 3; i++) {
+		unsigned long long ns0 = clock_ns(), t0 = tsc_begin();
+		nanosleep(&pause, NULL);
+		unsigned long long t1 = tsc_end(), ns1 = clock_ns();
+		double ratio = (double)(ns1 - ns0) / (t1 - t0);
+		if (best == 0 || ratio < best) best = ratio; // preemption only adds nanoseconds
 	}
-	return temp;
+	return best;
+}
+#endif
+
+int timer_init(int requested) {
+	source = TIMER_CLOCK;
+#ifdef HAVE_TSC
+	if (requested == TIMER_TSC && tsc_invariant()) {
+		ns_per_tick = tsc_calibrate();
+		source = TIMER_TSC;
+	}
+#endif
+	return source;
+}
+
+int timer_source(void) {
+	return source;
+}
+
+const char* timer_name(int id) {
+	return (id == TIMER_TSC) ? "tsc" : "clock";
+}
+
+int parse_timer(const char* name) {
+	if (strcmp(name, "clock") == 0) return TIMER_CLOCK;
+	if (strcmp(name, "tsc") == 0) return TIMER_TSC;
+	return -1;
 }
 
 void begin(timer* t) {
-	clock_gettime(CLOCK_MONOTONIC, &(t->begin));
+#ifdef HAVE_TSC
+	if (source == TIMER_TSC) {
+		t->begin = tsc_begin();
+		return;
+	}
+#endif
+	t->begin = clock_ns();
 }
 
 void end(timer* t) {
-	clock_gettime(CLOCK_MONOTONIC, &(t->end));
-	t->elapsed = diff(t->begin, t->end);
+#ifdef HAVE_TSC
+	if (source == TIMER_TSC) {
+		t->end = tsc_end();
+		t->elapsed = (unsigned long long)((t->end - t->begin) * ns_per_tick + 0.5);
+		return;
+	}
+#endif
+	t->end = clock_ns();
+	t->elapsed = t->end - t->begin;
 }
 
-unsigned long int get_nanoseconds(timer* t) {
-	return t->elapsed.tv_sec * 1000000000 + t->elapsed.tv_nsec;
+unsigned long long get_nanoseconds(timer* t) {
+	return t->elapsed;
 }
 
-unsigned long int get_microseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000);
+unsigned long long get_microseconds(timer* t) {
+	return (t->elapsed + 500) / 1000;
 }
 
-unsigned long int get_milliseconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000);
+unsigned long long get_milliseconds(timer* t) {
+	return (t->elapsed + 500000) / 1000000;
 }
 
-unsigned long int get_seconds(timer* t) {
-	return (unsigned int)round(get_nanoseconds(t)/1000000000);
+unsigned long long get_seconds(timer* t) {
+	return (t->elapsed + 500000000) / 1000000000;
 }
@@ -3,17 +3,33 @@
 
 #include <time.h>       /* time */
 
+/*
+ * begin() and end() read CLOCK_MONOTONIC by default. After
+ * timer_init(TIMER_TSC) they read the time-stamp counter instead
+ * (rdtscp plus fences, no system call), converted to nanoseconds with
+ * a ratio calibrated against CLOCK_MONOTONIC: use it for sub-microsecond
+ * regions. The TSC is used only if the CPU reports it as invariant,
+ * otherwise timer_init() keeps the clock and returns TIMER_CLOCK.
+ */
+#define TIMER_CLOCK 0
+#define TIMER_TSC   1
+
 typedef struct {
-	struct timespec begin;
-	struct timespec end;
-	struct timespec elapsed;
+	unsigned long long begin;   // nanoseconds or TSC ticks
+	unsigned long long end;
+	unsigned long long elapsed; // nanoseconds
 } timer;
 
+int timer_init(int source);
+int timer_source(void);
+const char* timer_name(int source);
+int parse_timer(const char* name);
+
 void begin(timer* t);
 void end(timer* t);
-unsigned long int get_seconds(timer* t);
-unsigned long int get_milliseconds(timer* t);
-unsigned long int get_microseconds(timer* t);
-unsigned long int get_nanoseconds(timer* t);
+unsigned long long get_seconds(timer* t);
+unsigned long long get_milliseconds(timer* t);
+unsigned long long get_microseconds(timer* t);
+unsigned long long get_nanoseconds(timer* t);
 
 #endif
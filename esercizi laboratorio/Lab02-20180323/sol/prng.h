@@ -0,0 +1,42 @@
+#ifndef __PRNG__
+#define __PRNG__
+
+/*
+ * Small per-thread pseudo-random number generator (xorshift64*).
+ *
+ * Unlike rand(), it has no hidden global state and takes no lock, so
+ * threads do not serialize on it. Seeding with the same (seed, stream)
+ * pair always yields the same sequence: give every thread its own
+ * stream (e.g. its id) to get independent but reproducible sequences.
+ */
+typedef struct {
+	unsigned long long state;
+} prng_t;
+
+static inline void prng_seed(prng_t* p, unsigned long long seed, unsigned long long stream) {
+	// splitmix64 scrambling: never yields the forbidden all-zero state in practice
+	unsigned long long z = seed + (stream + 1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z ^= z >> 31;
+	p->state = z ? z : 0x9E3779B97F4A7C15ULL;
+}
+
+static inline unsigned int prng_next(prng_t* p) {
+	p->state ^= p->state >> 12;
+	p->state ^= p->state << 25;
+	p->state ^= p->state >> 27;
+	return (unsigned int)((p->state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+// uniform integer in {0, ..., n - 1}
+static inline unsigned int prng_range(prng_t* p, unsigned int n) {
+	return (unsigned int)(((unsigned long long)prng_next(p) * n) >> 32);
+}
+
+// uniform double in [0, 1)
+static inline double prng_double(prng_t* p) {
+	return prng_next(p) / 4294967296.0;
+}
+
+#endif
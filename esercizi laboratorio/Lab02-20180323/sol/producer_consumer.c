@@ -1,9 +1,14 @@
+#include "performance.h"
+#include "ring.h"
+#include "prng.h"
+#include "ledger.h"
 #include <string.h>
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <time.h>       // nanosleep()
+#include <unistd.h>     // getopt()
 
 #define BUFFER_SIZE         128
 #define INITIAL_DEPOSIT     0
@@ -11,30 +16,84 @@
 #define NUM_CONSUMERS       2
 #define NUM_PRODUCERS       4
 #define PRNG_SEED           0
+#define TRANSACTION_DELAY   10000000 // 10 ms (10*10^6 ns)
+#define BATCH_SIZE          16
+#define REPORT_INTERVAL     100 // transactions between two balance reports
+#define LOG_QUEUE_SIZE      1024
+#define COMMIT_BUDGET       1000 // microseconds
 
 #define NUM_OPERATIONS      400
-#define OPS_PER_CONSUMER    (NUM_OPERATIONS/NUM_CONSUMERS)
-#define OPS_PER_PRODUCER    (NUM_OPERATIONS/NUM_PRODUCERS)
 
-// we use the preprocessor to check if our parameters are okay
-#if OPS_PER_CONSUMER*NUM_CONSUMERS != OPS_PER_PRODUCER*NUM_PRODUCERS
-#error "Choose NUM_CONSUMERS and NUM_PRODUCERS so that we get exactly NUM_OPERATIONS operations"
-#endif
+/*
+ * The transactions buffer can be either the original array guarded by
+ * semaphores (-m sem) or the lock-free ring of ring.h (-m ring), where
+ * producers enqueue and consumers dequeue up to BATCH_SIZE items at a
+ * time and consumers add their batch to deposit atomically. -m compare
+ * runs both without the artificial delay of performRandomTransaction(),
+ * so that the buffers (and not nanosleep) are measured.
+ *
+ * In throughput mode (-t) there is no artificial delay and every
+ * producer draws its transactions from its own prng_t seeded with
+ * PRNG_SEED and its thread id instead of the global (and locked)
+ * rand(). The number of producers, consumers and operations can be
+ * changed with -p, -c and -n: operations are split as evenly as
+ * possible. In both modes the final deposit is deterministic and is
+ * checked against the value computed by replaying the generators.
+ */
+#define MODE_SEM            0
+#define MODE_RING           1
+#define MODE_COMPARE        2
+
+/*
+ * Consumers do not touch deposit nor call printf for every item. Each
+ * consumed transaction gets a sequence number (under read_sem, or with
+ * a fetch_add per batch in ring mode) and consumers sum the values
+ * locally per block of REPORT_INTERVAL sequence numbers. When their
+ * block changes they publish the partial sum to deposit and to the
+ * block with atomic adds; whoever completes a block hands its number to
+ * the logger thread through a lock-free ring. The logger prints, in
+ * order, the balance after every REPORT_INTERVAL transactions, which is
+ * therefore exact even though consumers run out of order.
+ */
+typedef struct {
+    int block;  // block the partial sum belongs to, -1 if none yet
+    int sum;
+    int count;
+} partial_t;
+
+/*
+ * With -L <file> every consumed transaction is also appended to a
+ * durable ledger (ledger.h) with group commit: consumers do not wait
+ * for the disk, they only make sure that their last transaction is
+ * durable before terminating. At startup the ledger is replayed and
+ * the deposit restarts from the balance it left, instead of
+ * INITIAL_DEPOSIT. -B sets the latency budget of a commit group.
+ */
+ledger_t ledger;
+int use_ledger = 0;
+int initial_deposit = INITIAL_DEPOSIT;
+
+int* block_sums;
+int* block_counts;
+ring_t log_ring;
+
+long transaction_delay = TRANSACTION_DELAY; // nanoseconds
+int throughput = 0;
+int num_producers = NUM_PRODUCERS, num_consumers = NUM_CONSUMERS, num_operations = NUM_OPERATIONS;
+ring_t ring;
+int consumed; // sequence number of the next consumed transaction
 
 sem_t empty_sem, fill_sem;
 
-#if NUM_CONSUMERS > 1
+// only used with more than one consumer/producer
 sem_t read_sem;
-#endif
-
-#if NUM_PRODUCERS > 1
 sem_t write_sem;
-#endif
 
 // struct used to specify arguments for a thread
 typedef struct {
     int threadId;
     int numOps;
+    prng_t rng; // producers in throughput mode
 } thread_args_t;
 
 // shared data
@@ -42,13 +101,21 @@ int transactions[BUFFER_SIZE];
 int deposit = INITIAL_DEPOSIT;
 int read_index, write_index;
 
+// operations assigned to thread i out of threads: the first ones get the remainder
+static inline int opsForThread(int i, int threads) {
+    return num_operations / threads + (i < num_operations % threads);
+}
+
 // generates a number between -MAX_TRANSACTION and +MAX_TRANSACTION
-static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10000000; // 10 ms (100*10^6 ns)
-    nanosleep(&pause, NULL);
+static inline int performRandomTransaction(prng_t* rng) {
+    if (transaction_delay > 0) {
+        struct timespec pause = {0};
+        pause.tv_nsec = transaction_delay;
+        nanosleep(&pause, NULL);
+    }
 
-    int amount = rand() % (2 * MAX_TRANSACTION); // {0, ..., 2*MAX_TRANSACTION - 1}
+    int amount = throughput ? (int)prng_range(rng, 2 * MAX_TRANSACTION)
+                            : rand() % (2 * MAX_TRANSACTION); // {0, ..., 2*MAX_TRANSACTION - 1}
     if (amount >= MAX_TRANSACTION) {
         return MAX_TRANSACTION - (amount+1); // {-MAX_TRANSACTION, ..., -1}
     } else { 
@@ -67,25 +134,21 @@ void* performTransactions(void* x) {
             fprintf(stderr, "sem_wait error\n"); exit(EXIT_FAILURE);
         }
 
-    #if NUM_PRODUCERS > 1
         // get exclusive write access
-        if (sem_wait(&write_sem)) {
+        if (num_producers > 1 && sem_wait(&write_sem)) {
             fprintf(stderr, "sem_wait error\n"); exit(EXIT_FAILURE);
         }
-    #endif
 
         // produce the item
-        int currentTransaction = performRandomTransaction();
+        int currentTransaction = performRandomTransaction(&args->rng);
 
         // write the item and update write_index accordingly
         transactions[write_index] = currentTransaction;
         write_index = (write_index + 1) % BUFFER_SIZE;
 
-    #if NUM_PRODUCERS > 1
-        if (sem_post(&write_sem)) {
+        if (num_producers > 1 && sem_post(&write_sem)) {
             fprintf(stderr, "sem_post error\n"); exit(EXIT_FAILURE);
         }
-    #endif
 
         // notify that a new element just became available
         if (sem_post(&fill_sem)) {
@@ -100,9 +163,53 @@ void* performTransactions(void* x) {
     pthread_exit(NULL);
 }
 
+// publishes a partial sum to deposit and to its block
+static void publish(partial_t* p) {
+    if (p->count == 0) return;
+    __atomic_add_fetch(&deposit, p->sum, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&block_sums[p->block], p->sum, __ATOMIC_RELAXED);
+    if (__atomic_add_fetch(&block_counts[p->block], p->count, __ATOMIC_ACQ_REL) == REPORT_INTERVAL)
+        ring_enqueue(&log_ring, p->block); // we completed the block
+    p->sum = p->count = 0;
+}
+
+// accounts transaction number index in the local partial sum
+static inline void account(partial_t* p, int index, int value) {
+    int block = index / REPORT_INTERVAL;
+    if (block != p->block) {
+        publish(p);
+        p->block = block;
+    }
+    p->sum += value;
+    p->count++;
+}
+
+// prints the balance after every block of transactions, in order, as the
+// consumers report the completed blocks on the ring passed as arg
+void* logBalance(void* arg) {
+    ring_t* completed = (ring_t*)arg;
+    int num_blocks = num_operations / REPORT_INTERVAL;
+    char* done = calloc(num_blocks + 1, 1);
+    int next = 0, balance = initial_deposit;
+    while (1) {
+        int block = ring_dequeue(completed);
+        if (block < 0) break; // all the consumers have terminated
+        done[block] = 1;
+        while (next < num_blocks && done[next]) {
+            balance += __atomic_load_n(&block_sums[next], __ATOMIC_RELAXED);
+            ++next;
+            printf("After %d transactions balance is now %d.\n", next * REPORT_INTERVAL, balance);
+        }
+    }
+    free(done);
+    pthread_exit(NULL);
+}
+
 void* processTransactions(void* x) {
     thread_args_t* args = (thread_args_t*)x;
     printf("Starting consumer thread %d\n", args->threadId);
+    partial_t partial = { -1, 0, 0 };
+    unsigned long last_seq = 0;
 
     while (args->numOps > 0) {
         // make sure there is data to consume
@@ -110,24 +217,23 @@ void* processTransactions(void* x) {
             fprintf(stderr, "sem_wait error\n"); exit(EXIT_FAILURE);
         }
 
-    #if NUM_CONSUMERS > 1
         // get exclusive read access
-        if (sem_wait(&read_sem)) {
+        if (num_consumers > 1 && sem_wait(&read_sem)) {
             fprintf(stderr, "sem_wait error\n"); exit(EXIT_FAILURE);
         }
-    #endif
 
-        // consume the item and update (shared) variable deposit
-        deposit += transactions[read_index];
+        // consume the item and take the next sequence number
+        int value = transactions[read_index];
+        int index = consumed++;
         read_index = (read_index + 1) % BUFFER_SIZE;
-        if (read_index % 100 == 0)
-			printf("After the last 100 transactions balance is now %d.\n", deposit);
 
-    #if NUM_CONSUMERS > 1
-        if (sem_post(&read_sem)) {
+        if (num_consumers > 1 && sem_post(&read_sem)) {
             fprintf(stderr, "sem_post error\n"); exit(EXIT_FAILURE);
         }
-    #endif
+
+        // outside the critical section: local aggregation only
+        account(&partial, index, value);
+        if (use_ledger) last_seq = ledger_append(&ledger, value);
 
         args->numOps--;
         //printf("C %d\n", args->numOps);
@@ -138,83 +244,242 @@ void* processTransactions(void* x) {
         }
     }
 
+    publish(&partial);
+    if (use_ledger) ledger_wait(&ledger, last_seq);
     free(args);
     pthread_exit(NULL);
 }
 
-int main(int argc, char* argv[]) {
-    printf("Welcome! This program simulates financial transactions on a deposit.\n");
-    printf("\nThe maximum amount of a single transaction is %d (negative or positive).\n", MAX_TRANSACTION);
-    printf("\nInitial balance is %d. Press CTRL+C to quit.\n\n", INITIAL_DEPOSIT);
+// producer thread, ring mode
+void* performTransactionsRing(void* x) {
+    thread_args_t* args = (thread_args_t*)x;
+    printf("Starting producer thread %d\n", args->threadId);
+
+    int batch[BATCH_SIZE];
+    while (args->numOps > 0) {
+        int i, count = (args->numOps < BATCH_SIZE) ? args->numOps : BATCH_SIZE;
+        for (i = 0; i < count; ++i)
+            batch[i] = performRandomTransaction(&args->rng);
+
+        // blocks only while the ring is full
+        ring_enqueue_batch(&ring, batch, count);
+        args->numOps -= count;
+    }
+
+    free(args);
+    pthread_exit(NULL);
+}
+
+// consumer thread, ring mode
+void* processTransactionsRing(void* x) {
+    thread_args_t* args = (thread_args_t*)x;
+    printf("Starting consumer thread %d\n", args->threadId);
+
+    partial_t partial = { -1, 0, 0 };
+    unsigned long last_seq = 0;
+    int batch[BATCH_SIZE];
+    while (args->numOps > 0) {
+        // blocks only while the ring is empty
+        int i, count = ring_dequeue_batch(&ring, batch, (args->numOps < BATCH_SIZE) ? args->numOps : BATCH_SIZE);
+
+        // sequence numbers for the whole batch
+        int first = __atomic_fetch_add(&consumed, count, __ATOMIC_RELAXED);
+        for (i = 0; i < count; ++i)
+            account(&partial, first + i, batch[i]);
+        if (use_ledger) last_seq = ledger_append_batch(&ledger, batch, count);
 
+        args->numOps -= count;
+    }
+
+    publish(&partial);
+    if (use_ledger) ledger_wait(&ledger, last_seq);
+    free(args);
+    pthread_exit(NULL);
+}
+
+/*
+ * The final deposit does not depend on the interleaving: all the
+ * transactions are drawn either from the single rand() sequence or
+ * from the per-producer generators, so we can replay them here.
+ */
+int expectedDeposit() {
+    int i, j, balance = initial_deposit;
+    thread_args_t args;
+    long delay = transaction_delay;
+    transaction_delay = 0;
+    if (!throughput) srand(PRNG_SEED);
+    for (i = 0; i < num_producers; ++i) {
+        prng_seed(&args.rng, PRNG_SEED, i);
+        for (j = 0; j < opsForThread(i, num_producers); ++j)
+            balance += performRandomTransaction(&args.rng);
+    }
+    transaction_delay = delay;
+    return balance;
+}
+
+// runs the simulation with the given buffer, t measures it from start to end
+void run(int mode, timer* t) {
     // initialize read and write indexes
     read_index  = 0;
     write_index = 0;
+    deposit = initial_deposit;
+    consumed = 0;
 
     // initialize semaphores
     if (sem_init(&fill_sem, 0, 0)) { fprintf(stderr, "sem_init error\n"); exit(EXIT_FAILURE); } 
     if (sem_init(&empty_sem, 0, BUFFER_SIZE)) { fprintf(stderr, "sem_init error\n"); exit(EXIT_FAILURE); } 
 
-#if NUM_CONSUMERS > 1
     if (sem_init(&read_sem, 0, 1)) { fprintf(stderr, "sem_init error\n"); exit(EXIT_FAILURE); }
-#endif
-
-#if NUM_PRODUCERS > 1
     if (sem_init(&write_sem, 0, 1)) { fprintf(stderr, "sem_init error\n"); exit(EXIT_FAILURE); }
-#endif
 
     // set seed for pseudo-random number generator: we use this to make
     // this code yield the same result across different runs, as long
     // as they are race-free and you make no mistakes :-)
     srand(PRNG_SEED); 
 
+    if (mode == MODE_RING && ring_init(&ring, BUFFER_SIZE)) { fprintf(stderr, "ring_init error\n"); exit(EXIT_FAILURE); }
+
+    // per-block partial sums and the logger thread that reports them
+    block_sums = calloc(num_operations / REPORT_INTERVAL + 1, sizeof(int));
+    block_counts = calloc(num_operations / REPORT_INTERVAL + 1, sizeof(int));
+    if (block_sums == NULL || block_counts == NULL || ring_init(&log_ring, LOG_QUEUE_SIZE)) {
+        fprintf(stderr, "Cannot allocate memory!\n"); exit(EXIT_FAILURE);
+    }
+    pthread_t logger;
+
     int ret;
-    pthread_t producer[NUM_PRODUCERS], consumer[NUM_CONSUMERS];
+    pthread_t* producer = malloc(num_producers * sizeof(pthread_t));
+    pthread_t* consumer = malloc(num_consumers * sizeof(pthread_t));
+
+    begin(t);
+    ret = pthread_create(&logger, NULL, logBalance, &log_ring);
+    if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
 
     int i;
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<num_producers; ++i) {
         thread_args_t* arg = malloc(sizeof(thread_args_t));
         arg->threadId = i;
-        arg->numOps = OPS_PER_PRODUCER;
+        arg->numOps = opsForThread(i, num_producers);
+        prng_seed(&arg->rng, PRNG_SEED, i);
 
-        ret = pthread_create(&producer[i], NULL, performTransactions, arg);
+        ret = pthread_create(&producer[i], NULL, mode == MODE_RING ? performTransactionsRing : performTransactions, arg);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
     }
 
     int j;
-    for (j=0; j<NUM_CONSUMERS; ++j) {
+    for (j=0; j<num_consumers; ++j) {
         thread_args_t* arg = malloc(sizeof(thread_args_t));
         arg->threadId = j;
-        arg->numOps = OPS_PER_CONSUMER;
+        arg->numOps = opsForThread(j, num_consumers);
 
-        ret = pthread_create(&consumer[j], NULL, processTransactions, arg);
+        ret = pthread_create(&consumer[j], NULL, mode == MODE_RING ? processTransactionsRing : processTransactions, arg);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
     }
 
     // join on threads
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<num_producers; ++i) {
         ret = pthread_join(producer[i], NULL);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
     }
 
-    for (j=0; j<NUM_CONSUMERS; ++j) {
+    for (j=0; j<num_consumers; ++j) {
         ret = pthread_join(consumer[j], NULL);
         if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
     }
-
-    printf("Final value for deposit: %d\n", deposit);
+    end(t);
+
+    // no more blocks will be completed: let the logger drain its queue
+    ring_enqueue(&log_ring, -1);
+    ret = pthread_join(logger, NULL);
+    if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
+    ring_destroy(&log_ring);
+    free(block_sums);
+    free(block_counts);
+
+    free(producer);
+    free(consumer);
+
+    int expected = expectedDeposit();
+    printf("Final value for deposit: %d (expected %d)\n", deposit, expected);
+    printf("%d transactions in %llu ms (%.0f transactions/s)\n", num_operations, get_milliseconds(t),
+            num_operations / (get_nanoseconds(t) / 1e9));
+    if (use_ledger)
+        printf("%lu transactions durable with %lu fdatasync() calls (%.1f per call)\n", ledger_durable(&ledger),
+                ledger.syncs, ledger.syncs ? (double)ledger_durable(&ledger) / ledger.syncs : 0.0);
+    if (deposit != expected) { fprintf(stderr, "Wrong final deposit: there is a race somewhere!\n"); exit(EXIT_FAILURE); }
+
+    if (mode == MODE_RING) ring_destroy(&ring);
 
     // destroy semaphores
     if (sem_destroy(&fill_sem)) { fprintf(stderr, "sem_destroy error\n"); exit(EXIT_FAILURE); } 
     if (sem_destroy(&empty_sem)) { fprintf(stderr, "sem_destroy error\n"); exit(EXIT_FAILURE); } 
 
-#if NUM_CONSUMERS > 1
     if (sem_destroy(&read_sem)) { fprintf(stderr, "sem_destroy error\n"); exit(EXIT_FAILURE); }
-#endif
-
-#if NUM_PRODUCERS > 1
     if (sem_destroy(&write_sem)) { fprintf(stderr, "sem_destroy error\n"); exit(EXIT_FAILURE); }
-#endif
+}
+
+int main(int argc, char* argv[]) {
+    int mode = MODE_SEM, opt;
+    char* ledger_path = NULL;
+    long budget = COMMIT_BUDGET;
+    int bad_option = 0;
+    while ((opt = getopt(argc, argv, "m:tp:c:n:L:B:")) != -1) {
+        if (opt == 'm' && strcmp(optarg, "sem") == 0) mode = MODE_SEM;
+        else if (opt == 'm' && strcmp(optarg, "ring") == 0) mode = MODE_RING;
+        else if (opt == 'm' && strcmp(optarg, "compare") == 0) mode = MODE_COMPARE;
+        else if (opt == 't') throughput = 1;
+        else if (opt == 'p') num_producers = atoi(optarg);
+        else if (opt == 'c') num_consumers = atoi(optarg);
+        else if (opt == 'n') num_operations = atoi(optarg);
+        else if (opt == 'L') ledger_path = optarg;
+        else if (opt == 'B') budget = atol(optarg);
+        else bad_option = 1;
+    }
+    // the ledger records a single history: not two runs of the same transactions
+    if (bad_option || num_producers < 1 || num_consumers < 1 || num_operations < 0 || budget < 0 ||
+            (ledger_path != NULL && mode == MODE_COMPARE)) {
+        fprintf(stderr, "Syntax: %s [-m sem|ring|compare] [-t] [-p <producers>] [-c <consumers>] [-n <operations>] "
+                "[-L <ledger> [-B <budget us>]]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (throughput) transaction_delay = 0;
+
+    printf("Welcome! This program simulates financial transactions on a deposit.\n");
+    printf("\nThe maximum amount of a single transaction is %d (negative or positive).\n", MAX_TRANSACTION);
+
+    if (ledger_path != NULL) {
+        long sum;
+        unsigned long records;
+        if (ledger_replay(ledger_path, &sum, &records)) {
+            fprintf(stderr, "Cannot replay the ledger %s\n", ledger_path); exit(EXIT_FAILURE);
+        }
+        initial_deposit = INITIAL_DEPOSIT + (int)sum;
+        printf("\nReplayed %lu transactions from %s.\n", records, ledger_path);
+        if (ledger_open(&ledger, ledger_path, budget)) {
+            fprintf(stderr, "Cannot open the ledger %s\n", ledger_path); exit(EXIT_FAILURE);
+        }
+        use_ledger = 1;
+    }
+    printf("\nInitial balance is %d. Press CTRL+C to quit.\n\n", initial_deposit);
+
+    timer t;
+    if (mode != MODE_COMPARE) {
+        run(mode, &t);
+        if (use_ledger) ledger_close(&ledger);
+        exit(EXIT_SUCCESS);
+    }
+
+    // same transactions through both buffers, without the artificial delay
+    timer t_ring;
+    transaction_delay = 0;
+    throughput = 1;
+    run(MODE_SEM, &t);
+    int sem_deposit = deposit;
+    run(MODE_RING, &t_ring);
+    printf("\n%-10s %12s %18s\n", "buffer", "deposit", "transactions/s");
+    printf("%-10s %12d %18.0f\n", "semaphores", sem_deposit, num_operations / (get_nanoseconds(&t) / 1e9));
+    printf("%-10s %12d %18.0f\n", "ring", deposit, num_operations / (get_nanoseconds(&t_ring) / 1e9));
+    if (sem_deposit != deposit) { fprintf(stderr, "The two buffers disagree on the final deposit!\n"); exit(EXIT_FAILURE); }
 
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "ring.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(atomic_int* word, int expected) {
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(atomic_int* word, int count) {
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+int ring_init(ring_t* ring, size_t capacity) {
+	size_t size = 1, i;
+	while (size < capacity) size <<= 1;
+	ring->slots = (ring_slot_t*)aligned_alloc(RING_CACHE_LINE,
+			((size * sizeof(ring_slot_t) + RING_CACHE_LINE - 1) / RING_CACHE_LINE) * RING_CACHE_LINE);
+	if (ring->slots == NULL) return -1;
+	for (i = 0; i < size; i++)
+		atomic_init(&ring->slots[i].seq, i);
+	ring->capacity = size;
+	ring->mask = size - 1;
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->not_empty, 0);
+	atomic_init(&ring->empty_waiters, 0);
+	atomic_init(&ring->not_full, 0);
+	atomic_init(&ring->full_waiters, 0);
+	return 0;
+}
+
+void ring_destroy(ring_t* ring) {
+	free(ring->slots);
+	ring->slots = NULL;
+}
+
+size_t ring_try_enqueue_batch(ring_t* ring, const int* values, size_t count) {
+	unsigned long pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	for (;;) {
+		// how many consecutive slots from pos are free for this lap?
+		size_t n = 0;
+		while (n < count) {
+			ring_slot_t* slot = &ring->slots[(pos + n) & ring->mask];
+			if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + n) break;
+			n++;
+		}
+		if (n == 0) {
+			ring_slot_t* slot = &ring->slots[pos & ring->mask];
+			long diff = (long)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+			if (diff < 0) return 0; // still to be consumed: the ring is full
+			pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+			continue;
+		}
+		/*
+		 * If tail is still pos nobody else claimed those slots, and
+		 * consumers cannot make a free slot busy again.
+		 */
+		if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + n,
+				memory_order_relaxed, memory_order_relaxed)) {
+			size_t i;
+			for (i = 0; i < n; i++) {
+				ring_slot_t* slot = &ring->slots[(pos + i) & ring->mask];
+				slot->value = values[i];
+				atomic_store_explicit(&slot->seq, pos + i + 1, memory_order_release);
+			}
+			return n;
+		}
+	}
+}
+
+size_t ring_try_dequeue_batch(ring_t* ring, int* values, size_t count) {
+	unsigned long pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	for (;;) {
+		size_t n = 0;
+		while (n < count) {
+			ring_slot_t* slot = &ring->slots[(pos + n) & ring->mask];
+			if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + n + 1) break;
+			n++;
+		}
+		if (n == 0) {
+			ring_slot_t* slot = &ring->slots[pos & ring->mask];
+			long diff = (long)(atomic_load_explicit(&slot->seq, memory_order_acquire) - (pos + 1));
+			if (diff < 0) return 0; // not produced yet: the ring is empty
+			pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+			continue;
+		}
+		if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + n,
+				memory_order_relaxed, memory_order_relaxed)) {
+			size_t i;
+			for (i = 0; i < n; i++) {
+				ring_slot_t* slot = &ring->slots[(pos + i) & ring->mask];
+				values[i] = slot->value;
+				atomic_store_explicit(&slot->seq, pos + i + ring->capacity, memory_order_release);
+			}
+			return n;
+		}
+	}
+}
+
+// tells parked threads of the other side that count slots changed state
+static void notify(atomic_int* word, atomic_int* waiters, size_t count) {
+	atomic_fetch_add(word, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(waiters) > 0)
+		futex_wake(word, count > INT_MAX ? INT_MAX : (int)count);
+}
+
+/*
+ * Parks until *word differs from key. Callers read key, register in
+ * waiters and retry once before parking: a notify racing with them
+ * either sees the waiter or changes the word, so no wake-up is lost.
+ */
+static void park(atomic_int* word, atomic_int* waiters, int key) {
+	futex_wait(word, key);
+	atomic_fetch_sub(waiters, 1);
+}
+
+void ring_enqueue_batch(ring_t* ring, const int* values, size_t count) {
+	int spins = 0;
+	while (count > 0) {
+		size_t n = ring_try_enqueue_batch(ring, values, count);
+		if (n > 0) {
+			notify(&ring->not_empty, &ring->empty_waiters, n);
+			values += n;
+			count -= n;
+			spins = 0;
+			continue;
+		}
+		if (spins++ < RING_SPINS) {
+			cpu_relax();
+			continue;
+		}
+		int key = atomic_load(&ring->not_full);
+		atomic_fetch_add(&ring->full_waiters, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		n = ring_try_enqueue_batch(ring, values, count);
+		if (n > 0) {
+			atomic_fetch_sub(&ring->full_waiters, 1);
+			notify(&ring->not_empty, &ring->empty_waiters, n);
+			values += n;
+			count -= n;
+		} else {
+			park(&ring->not_full, &ring->full_waiters, key);
+		}
+		spins = 0;
+	}
+}
+
+size_t ring_dequeue_batch(ring_t* ring, int* values, size_t count) {
+	int spins = 0;
+	for (;;) {
+		size_t n = ring_try_dequeue_batch(ring, values, count);
+		if (n > 0) {
+			notify(&ring->not_full, &ring->full_waiters, n);
+			return n;
+		}
+		if (spins++ < RING_SPINS) {
+			cpu_relax();
+			continue;
+		}
+		int key = atomic_load(&ring->not_empty);
+		atomic_fetch_add(&ring->empty_waiters, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		n = ring_try_dequeue_batch(ring, values, count);
+		if (n > 0) {
+			atomic_fetch_sub(&ring->empty_waiters, 1);
+			notify(&ring->not_full, &ring->full_waiters, n);
+			return n;
+		}
+		park(&ring->not_empty, &ring->empty_waiters, key);
+		spins = 0;
+	}
+}
+
+void ring_enqueue(ring_t* ring, int value) {
+	ring_enqueue_batch(ring, &value, 1);
+}
+
+int ring_dequeue(ring_t* ring) {
+	int value;
+	ring_dequeue_batch(ring, &value, 1);
+	return value;
+}
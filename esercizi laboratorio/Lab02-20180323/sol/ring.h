@@ -0,0 +1,58 @@
+#ifndef __RING__
+#define __RING__
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue of ints.
+ *
+ * Every slot carries a sequence number telling which lap of the ring
+ * it is ready for: a producer may fill slot pos when seq == pos, a
+ * consumer may empty it when seq == pos + 1. Producers and consumers
+ * only compete through a compare-and-swap on tail and head
+ * respectively, which live on different cache lines. The batch
+ * versions claim several consecutive slots with a single
+ * compare-and-swap.
+ *
+ * The blocking calls spin RING_SPINS times and then park on a futex
+ * word (not_full or not_empty) that the other side bumps after every
+ * operation; the wake-up system call is only issued when somebody is
+ * actually parked.
+ */
+#define RING_SPINS 128
+#define RING_CACHE_LINE 64
+
+typedef struct {
+	atomic_ulong seq;
+	int value;
+} ring_slot_t;
+
+typedef struct {
+	atomic_ulong head __attribute__((aligned(RING_CACHE_LINE)));   // next slot to dequeue
+	atomic_ulong tail __attribute__((aligned(RING_CACHE_LINE)));   // next slot to enqueue
+	atomic_int not_empty __attribute__((aligned(RING_CACHE_LINE))); // futex words
+	atomic_int empty_waiters;
+	atomic_int not_full __attribute__((aligned(RING_CACHE_LINE)));
+	atomic_int full_waiters;
+	ring_slot_t* slots __attribute__((aligned(RING_CACHE_LINE)));
+	unsigned long mask;
+	size_t capacity;
+} ring_t;
+
+// capacity is rounded up to a power of two; returns 0 on success
+int ring_init(ring_t* ring, size_t capacity);
+void ring_destroy(ring_t* ring);
+
+// non-blocking: return how many items were enqueued/dequeued (maybe 0)
+size_t ring_try_enqueue_batch(ring_t* ring, const int* values, size_t count);
+size_t ring_try_dequeue_batch(ring_t* ring, int* values, size_t count);
+
+// blocking: enqueue all the values / dequeue at least one of them
+void ring_enqueue_batch(ring_t* ring, const int* values, size_t count);
+size_t ring_dequeue_batch(ring_t* ring, int* values, size_t count);
+
+void ring_enqueue(ring_t* ring, int value);
+int ring_dequeue(ring_t* ring);
+
+#endif
@@ -0,0 +1,232 @@
+#include "performance.h"
+#include "accounts.h"
+#include "ring.h"
+#include "prng.h"
+#include "zipf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>     // getopt()
+
+/*
+ * producer_consumer.c with a table of accounts instead of a single
+ * deposit: producers emit transfers (from, to, amount) and deposits
+ * (from == -1), consumers apply them to the accounts_t of accounts.h.
+ *
+ * Transfers travel through a pool of POOL_SIZE slots and two rings of
+ * ring.h holding slot indices: producers take a free slot, fill it and
+ * enqueue its index on the work ring; consumers dequeue up to
+ * BATCH_SIZE indices at a time, apply the transfers and give the slots
+ * back. Accounts are drawn from a Zipf distribution of skew -z (0 is
+ * uniform). At the end the total balance must be the initial one plus
+ * the accepted deposits: transfers only move money around.
+ */
+#define NUM_ACCOUNTS        (1 << 20)
+#define INITIAL_BALANCE     1000
+#define MAX_AMOUNT          100
+#define DEPOSIT_PERCENT     10
+#define NUM_PRODUCERS       2
+#define NUM_CONSUMERS       2
+#define NUM_OPERATIONS      1000000
+#define POOL_SIZE           1024
+#define BATCH_SIZE          16
+#define PRNG_SEED           0
+
+typedef struct {
+	int from;   // -1 for a deposit
+	int to;
+	long amount;
+} transfer_t;
+
+typedef struct {
+	int thread_id;
+	int num_ops;
+	prng_t rng;
+	// consumers only
+	long deposited;
+	int rejected;
+} thread_args_t;
+
+int num_accounts = NUM_ACCOUNTS;
+int num_producers = NUM_PRODUCERS;
+int num_consumers = NUM_CONSUMERS;
+int num_operations = NUM_OPERATIONS;
+int deposit_percent = DEPOSIT_PERCENT;
+double skew = 0;
+
+accounts_t accounts;
+zipf_t zipf;
+transfer_t pool[POOL_SIZE];
+ring_t free_slots;  // indices of the empty slots of pool
+ring_t work;        // indices of the filled slots of pool
+
+// operations are split as evenly as possible among the threads
+int ops_for_thread(int i, int threads) {
+	return num_operations / threads + (i < num_operations % threads);
+}
+
+void* producer(void* x) {
+	thread_args_t* args = (thread_args_t*)x;
+	int i;
+	for (i = 0; i < args->num_ops; i++) {
+		int slot = ring_dequeue(&free_slots);
+		transfer_t* t = &pool[slot];
+		t->to = zipf_next(&zipf, &args->rng);
+		t->amount = 1 + prng_range(&args->rng, MAX_AMOUNT);
+		if ((int)prng_range(&args->rng, 100) < deposit_percent) {
+			t->from = -1;
+		} else {
+			t->from = zipf_next(&zipf, &args->rng);
+			if (t->from == t->to) t->from = (t->from + 1) % num_accounts;
+		}
+		ring_enqueue(&work, slot);
+	}
+	pthread_exit(NULL);
+}
+
+void* consumer(void* x) {
+	thread_args_t* args = (thread_args_t*)x;
+	int batch[BATCH_SIZE];
+	while (args->num_ops > 0) {
+		int i, count = ring_dequeue_batch(&work, batch, (args->num_ops < BATCH_SIZE) ? args->num_ops : BATCH_SIZE);
+		for (i = 0; i < count; i++) {
+			transfer_t* t = &pool[batch[i]];
+			if (t->from < 0) {
+				if (accounts_deposit(&accounts, t->to, t->amount))
+					args->deposited += t->amount;
+				else
+					args->rejected++;
+			} else if (!accounts_transfer(&accounts, t->from, t->to, t->amount)) {
+				args->rejected++;
+			}
+		}
+		ring_enqueue_batch(&free_slots, batch, count);
+		args->num_ops -= count;
+	}
+	pthread_exit(NULL);
+}
+
+/*
+ * Runs the simulation once and returns the throughput in operations
+ * per second. Exits if the total balance is not conserved.
+ */
+double run(int locking, int* rejected) {
+	int i, ret;
+	if (accounts_init(&accounts, num_accounts, INITIAL_BALANCE, locking) ||
+			zipf_init(&zipf, num_accounts, skew) ||
+			ring_init(&free_slots, POOL_SIZE) || ring_init(&work, POOL_SIZE)) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < POOL_SIZE; i++)
+		ring_enqueue(&free_slots, i);
+
+	pthread_t* threads = (pthread_t*)malloc((num_producers + num_consumers) * sizeof(pthread_t));
+	thread_args_t* args = (thread_args_t*)calloc(num_producers + num_consumers, sizeof(thread_args_t));
+	if (threads == NULL || args == NULL) {
+		fprintf(stderr, "Cannot allocate memory!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	timer t;
+	begin(&t);
+	for (i = 0; i < num_producers + num_consumers; i++) {
+		int is_producer = i < num_producers;
+		args[i].thread_id = is_producer ? i : i - num_producers;
+		args[i].num_ops = is_producer ? ops_for_thread(i, num_producers) : ops_for_thread(i - num_producers, num_consumers);
+		prng_seed(&args[i].rng, PRNG_SEED, i);
+		ret = pthread_create(&threads[i], NULL, is_producer ? producer : consumer, &args[i]);
+		if (ret != 0) { fprintf(stderr, "Error %d in pthread_create\n", ret); exit(EXIT_FAILURE); }
+	}
+	for (i = 0; i < num_producers + num_consumers; i++) {
+		ret = pthread_join(threads[i], NULL);
+		if (ret != 0) { fprintf(stderr, "Error %d in pthread_join\n", ret); exit(EXIT_FAILURE); }
+	}
+	end(&t);
+
+	// conservation: transfers only move money, deposits add it
+	long deposited = 0;
+	*rejected = 0;
+	for (i = num_producers; i < num_producers + num_consumers; i++) {
+		deposited += args[i].deposited;
+		*rejected += args[i].rejected;
+	}
+	long expected = (long)num_accounts * INITIAL_BALANCE + deposited;
+	long total = accounts_total(&accounts);
+	if (total != expected) {
+		fprintf(stderr, "Total balance %ld, expected %ld: money was created or lost!\n", total, expected);
+		exit(EXIT_FAILURE);
+	}
+
+	free(threads);
+	free(args);
+	ring_destroy(&work);
+	ring_destroy(&free_slots);
+	zipf_destroy(&zipf);
+	accounts_destroy(&accounts);
+	return num_operations / (get_nanoseconds(&t) / 1e9);
+}
+
+// throughput as accounts, consumers and skew vary, for both lockings
+void sweep() {
+	static const int accounts_sizes[] = { 1024, 1 << 20 };
+	static const int consumers[] = { 1, 2, 4, 8 };
+	static const double skews[] = { 0, 0.99, 1.5 };
+	int a, c, s, l, rejected;
+	printf("%-8s %9s %9s %5s %14s %9s\n", "locking", "accounts", "consumers", "skew", "operations/s", "rejected");
+	for (l = 0; l < NUM_ACCOUNT_LOCKS; l++)
+		for (a = 0; a < 2; a++)
+			for (c = 0; c < 4; c++)
+				for (s = 0; s < 3; s++) {
+					num_accounts = accounts_sizes[a];
+					num_consumers = consumers[c];
+					skew = skews[s];
+					double throughput = run(l, &rejected);
+					printf("%-8s %9d %9d %5.2f %14.0f %9d\n", account_lock_name(l), num_accounts,
+							num_consumers, skew, throughput, rejected);
+					fflush(stdout);
+				}
+	printf("Total balance conserved in every run\n");
+}
+
+void usage(char* prog) {
+	fprintf(stderr, "Syntax: %s [-l striped|account] [-a <accounts>] [-p <producers>] [-c <consumers>] "
+			"[-n <operations>] [-z <skew>] [-d <deposit%%>] [-b]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+	int locking = ACCOUNT_LOCK_STRIPED, bench = 0, opt;
+	while ((opt = getopt(argc, argv, "l:a:p:c:n:z:d:b")) != -1) {
+		switch (opt) {
+		case 'l':
+			locking = parse_account_lock(optarg);
+			if (locking < 0) usage(argv[0]);
+			break;
+		case 'a': num_accounts = atoi(optarg); break;
+		case 'p': num_producers = atoi(optarg); break;
+		case 'c': num_consumers = atoi(optarg); break;
+		case 'n': num_operations = atoi(optarg); break;
+		case 'z': skew = atof(optarg); break;
+		case 'd': deposit_percent = atoi(optarg); break;
+		case 'b': bench = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (optind != argc || num_accounts < 2 || num_producers < 1 || num_consumers < 1 ||
+			num_operations < 1 || skew < 0 || deposit_percent < 0 || deposit_percent > 100)
+		usage(argv[0]);
+
+	if (bench) {
+		sweep();
+		return EXIT_SUCCESS;
+	}
+
+	int rejected;
+	double throughput = run(locking, &rejected);
+	printf("%d operations on %d accounts (%s locking, skew %.2f): %.0f operations/s, %d rejected\n",
+			num_operations, num_accounts, account_lock_name(locking), skew, throughput, rejected);
+	printf("Total balance conserved\n");
+	return EXIT_SUCCESS;
+}
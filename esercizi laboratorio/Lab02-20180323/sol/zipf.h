@@ -0,0 +1,61 @@
+#ifndef __ZIPF__
+#define __ZIPF__
+
+#include "prng.h"
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Zipf-distributed ranks in {0, ..., n - 1}: rank k is drawn with
+ * probability proportional to 1 / (k + 1)^s, s = 0 being uniform. The
+ * cumulative distribution is computed once and shared (read-only) by
+ * all the threads, each drawing with its own prng_t and a binary
+ * search. Ranks are then scattered over the keys by multiplying by a
+ * prime, so that the hot keys are not all next to each other.
+ */
+#define ZIPF_SCATTER 1000003UL
+
+typedef struct {
+	double* cdf;    // NULL if s == 0
+	int n;
+	unsigned long scatter;
+} zipf_t;
+
+// returns 0 on success
+static inline int zipf_init(zipf_t* z, int n, double s) {
+	z->n = n;
+	z->cdf = NULL;
+	z->scatter = (n % ZIPF_SCATTER == 0) ? 1 : ZIPF_SCATTER;
+	if (s == 0) return 0;
+
+	z->cdf = (double*)malloc(n * sizeof(double));
+	if (z->cdf == NULL) return -1;
+	double total = 0;
+	int k;
+	for (k = 0; k < n; k++) {
+		total += 1.0 / pow(k + 1, s);
+		z->cdf[k] = total;
+	}
+	for (k = 0; k < n; k++)
+		z->cdf[k] /= total;
+	return 0;
+}
+
+static inline int zipf_next(zipf_t* z, prng_t* p) {
+	if (z->cdf == NULL) return (int)prng_range(p, z->n);
+	double u = prng_double(p);
+	int low = 0, high = z->n - 1;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		if (z->cdf[mid] > u) high = mid;
+		else low = mid + 1;
+	}
+	return (int)((low * z->scatter) % z->n);
+}
+
+static inline void zipf_destroy(zipf_t* z) {
+	free(z->cdf);
+	z->cdf = NULL;
+}
+
+#endif
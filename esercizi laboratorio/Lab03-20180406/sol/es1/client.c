@@ -1,8 +1,10 @@
 #include "util.h"
+#include "stats.h"
+#include "scheduler.h"
+#include "loadgen.h"
 
 #include <errno.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,28 +13,33 @@
 
 #define MAX_SLEEP           6
 #define THREAD_BURST        5
-#define SEMAPHORE_NAME      "/simple_scheduler"
 
 typedef struct thread_args_s {
     int     ID;
 } thread_args_t;
 
+// the scheduler and the statistics shared with the server
+scheduler_t* scheduler;
+stats_region_t* stats;
+
+// class and priority of the resources asked by our threads (-c and -p)
+int resource_class = 0;
+int priority = 0;
+
 void* client(void *arg_ptr) {
     thread_args_t* args = (thread_args_t*) arg_ptr;
     char errorStr[100];
 
-    /*** Open an existing named semaphore - COMPLETE HERE ***/
-    sem_t* my_named_semaphore = sem_open(SEMAPHORE_NAME, 0); // oflag is 0: sem_open is not allowed to create it!
-    if (my_named_semaphore == SEM_FAILED) {
-        sprintf(errorStr,"Could not open the named semaphore from thread %d", args->ID);
-        handle_error(errorStr);
-    }
-
-    /*** Acquire the resource ***/
-    if (sem_wait(my_named_semaphore)) {
-        sprintf(errorStr,"Could not lock the semaphore from thread %d", args->ID);
+    /*** Acquire the resource, recording how long we waited for it ***/
+    int slot = statsSlot(args->ID);
+    unsigned long long requested = statsNow();
+    statsRequest(stats, slot);
+    if (schedulerAcquire(scheduler, resource_class, priority)) {
+        sprintf(errorStr,"Could not acquire a resource from thread %d", args->ID);
         handle_error(errorStr);
     }
+    unsigned long long granted = statsNow();
+    statsGranted(stats, slot, granted - requested);
 
     printf("[@Thread%d] Resource acquired...\n", args->ID);
 
@@ -40,27 +47,72 @@ void* client(void *arg_ptr) {
     sleep(rand() % (MAX_SLEEP+1));
 
     /*** Free the resource ***/
-    if (sem_post(my_named_semaphore)) {
-        sprintf(errorStr,"Could not unlock the semaphore from thread %d", args->ID);
-        handle_error(errorStr);
-    }
+    schedulerRelease(scheduler, resource_class);
+    statsReleased(stats, slot, statsNow() - granted);
 
     printf("[@Thread%d] Done. Resource released!\n", args->ID);
 
-    /*** Close the named semaphore - COMPLETE HERE ***/
-    sem_close(my_named_semaphore);
-
     free(args);
     return NULL;
 }
 
+static void syntax(const char* program) {
+    fprintf(stderr, "Syntax: %s [-c <class>] [-p <priority 0-%d>] [-L <requests/s> [-n <requests>] "
+            "[-a poisson|constant] [-h <hold us>] [-d constant|exponential|uniform] [-w <workers>]]\n",
+            program, NUM_PRIORITIES-1);
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char* argv[]) {
-    int thread_ID = 0;
+    int thread_ID = 0, opt;
     char errorStr[100];
 
-    printf("Welcome! This is a simple client for our FCFS scheduler.\n\n");
+    /* -c and -p choose the class and the priority of the resources we ask for.
+     * -L <rate> runs the load generator of loadgen.h instead of the interactive
+     * driver: -n requests, -a poisson|constant arrivals, -h mean hold time in
+     * us with a constant|exponential|uniform (-d) distribution, -w workers. */
+    loadgen_config_t load = {
+        .rate = 0,
+        .arrivals = ARRIVALS_POISSON,
+        .requests = 1000,
+        .workers = 16,
+        .hold = HOLD_EXPONENTIAL,
+        .hold_us = 1000,
+        .resource_class = 0,
+        .priority = 0,
+    };
+    int load_options = 0; // -n/-a/-h/-d/-w make sense only with -L
+    while ((opt = getopt(argc, argv, "c:p:L:n:a:h:d:w:")) != -1) {
+        if (opt == 'c') resource_class = atoi(optarg);
+        else if (opt == 'p') priority = atoi(optarg);
+        else if (opt == 'L' && (load.rate = atof(optarg)) > 0) continue;
+        else if (opt == 'n' && (load.requests = atoi(optarg)) > 0) load_options = 1;
+        else if (opt == 'a' && (load.arrivals = parseArrivals(optarg)) != -1) load_options = 1;
+        else if (opt == 'h' && (load.hold_us = atof(optarg)) >= 0) load_options = 1;
+        else if (opt == 'd' && (load.hold = parseHold(optarg)) != -1) load_options = 1;
+        else if (opt == 'w' && (load.workers = atoi(optarg)) > 0) load_options = 1;
+        else syntax(argv[0]);
+    }
+    if (load_options && load.rate == 0) syntax(argv[0]);
+
+    printf("Welcome! This is a simple client for our FIFO scheduler.\n\n");
     printf("Please make sure that the server is already running in a separate terminal.\n\n");
 
+    scheduler = schedulerOpen();
+    stats = statsOpen();
+    if (resource_class < 0 || resource_class >= scheduler->num_classes || priority < 0 || priority >= NUM_PRIORITIES) {
+        fprintf(stderr, "The server has %d classes (0-%d) and priorities go from 0 to %d\n",
+                scheduler->num_classes, scheduler->num_classes-1, NUM_PRIORITIES-1);
+        exit(EXIT_FAILURE);
+    }
+
+    if (load.rate > 0) {
+        load.resource_class = resource_class;
+        load.priority = priority;
+        runLoadGenerator(scheduler, stats, &load);
+        return 0;
+    }
+
     /* Main loop */
     printf("[DRIVER] Press ENTER to spawn %d new threads. Press CTRL+D to quit!\n", THREAD_BURST);
 
@@ -0,0 +1,172 @@
+#include "loadgen.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#define LOADGEN_SEED        0
+
+typedef struct {
+    unsigned long long arrival_ns;  // scheduled arrival
+    unsigned long long hold_ns;
+} request_t;
+
+// the bounded queue between the arrival process and the workers
+static request_t queue[LOADGEN_QUEUE];
+static int head, count, closed;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_filled = PTHREAD_COND_INITIALIZER;
+
+static scheduler_t* scheduler;
+static stats_region_t* stats;
+static loadgen_config_t* config;
+static unsigned long long* latencies;   // time-to-grant of each request
+static int completed;
+static unsigned long long total_hold_ns;
+
+int parseArrivals(const char* name) {
+    if (strcmp(name, "poisson") == 0) return ARRIVALS_POISSON;
+    if (strcmp(name, "constant") == 0) return ARRIVALS_CONSTANT;
+    return -1;
+}
+
+int parseHold(const char* name) {
+    if (strcmp(name, "constant") == 0) return HOLD_CONSTANT;
+    if (strcmp(name, "exponential") == 0) return HOLD_EXPONENTIAL;
+    if (strcmp(name, "uniform") == 0) return HOLD_UNIFORM;
+    return -1;
+}
+
+// exponential with the given mean; 1 - erand48() is in (0, 1]
+static double exponential(unsigned short* rng, double mean) {
+    return -mean * log(1 - erand48(rng));
+}
+
+static void sleepUntil(unsigned long long ns) {
+    struct timespec t = { ns / 1000000000ULL, ns % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+        continue;
+}
+
+static void* worker(void* arg) {
+    int slot = statsSlot((int)(long)arg);
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (count == 0 && !closed)
+            pthread_cond_wait(&queue_filled, &queue_lock);
+        if (count == 0) {
+            pthread_mutex_unlock(&queue_lock);
+            return NULL;
+        }
+        request_t r = queue[head];
+        head = (head + 1) % LOADGEN_QUEUE;
+        count--;
+        pthread_mutex_unlock(&queue_lock);
+
+        statsRequest(stats, slot);
+        if (schedulerAcquire(scheduler, config->resource_class, config->priority))
+            handle_error("Could not acquire a resource");
+        unsigned long long granted = statsNow();
+        statsGranted(stats, slot, granted - r.arrival_ns);
+
+        sleepUntil(granted + r.hold_ns);
+        schedulerRelease(scheduler, config->resource_class);
+        unsigned long long hold = statsNow() - granted;
+        statsReleased(stats, slot, hold);
+
+        int i = __atomic_fetch_add(&completed, 1, __ATOMIC_RELAXED);
+        latencies[i] = granted - r.arrival_ns;
+        __atomic_fetch_add(&total_hold_ns, hold, __ATOMIC_RELAXED);
+    }
+}
+
+static int compare(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a, y = *(const unsigned long long*)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p) {
+    int i = (int)ceil(p / 100 * completed) - 1;
+    return latencies[i < 0 ? 0 : i] / 1e3;
+}
+
+void runLoadGenerator(scheduler_t* s, stats_region_t* st, loadgen_config_t* c) {
+    scheduler = s;
+    stats = st;
+    config = c;
+    latencies = malloc(c->requests * sizeof(unsigned long long));
+    pthread_t* workers = malloc(c->workers * sizeof(pthread_t));
+    if (latencies == NULL || workers == NULL) handle_error("malloc");
+
+    long i;
+    int ret;
+    for (i = 0; i < c->workers; ++i) {
+        ret = pthread_create(&workers[i], NULL, worker, (void*)i);
+        if (ret) handle_error_en(ret, "Cannot create a worker");
+    }
+
+    printf("[LOADGEN] %d requests, %s arrivals at %.1f/s, %s hold time of %.0f us on average, %d workers\n",
+            c->requests, c->arrivals == ARRIVALS_POISSON ? "Poisson" : "constant", c->rate,
+            c->hold == HOLD_CONSTANT ? "constant" : c->hold == HOLD_EXPONENTIAL ? "exponential" : "uniform",
+            c->hold_us, c->workers);
+
+    /** The arrival process: never waits for the workers. **/
+    unsigned short rng[3] = { LOADGEN_SEED, 0, 0 };
+    int dropped = 0;
+    unsigned long long start = statsNow();
+    double arrival = 0; // ns since start
+    for (i = 0; i < c->requests; ++i) {
+        arrival += (c->arrivals == ARRIVALS_POISSON) ? exponential(rng, 1e9 / c->rate) : 1e9 / c->rate;
+        request_t r;
+        r.arrival_ns = start + (unsigned long long)arrival;
+        double hold = (c->hold == HOLD_EXPONENTIAL) ? exponential(rng, c->hold_us)
+                    : (c->hold == HOLD_UNIFORM) ? 2 * c->hold_us * erand48(rng) : c->hold_us;
+        r.hold_ns = (unsigned long long)(hold * 1e3);
+        sleepUntil(r.arrival_ns);
+
+        pthread_mutex_lock(&queue_lock);
+        if (count == LOADGEN_QUEUE) {
+            dropped++;
+        } else {
+            queue[(head + count) % LOADGEN_QUEUE] = r;
+            count++;
+            pthread_cond_signal(&queue_filled);
+        }
+        pthread_mutex_unlock(&queue_lock);
+    }
+    double sending = (statsNow() - start) / 1e9;
+
+    pthread_mutex_lock(&queue_lock);
+    closed = 1;
+    pthread_cond_broadcast(&queue_filled);
+    pthread_mutex_unlock(&queue_lock);
+    for (i = 0; i < c->workers; ++i) {
+        ret = pthread_join(workers[i], NULL);
+        if (ret) handle_error_en(ret, "Cannot join a worker");
+    }
+    double elapsed = (statsNow() - start) / 1e9;
+
+    /** The report **/
+    printf("[LOADGEN] %d requests sent in %.2f s (%.1f/s), %d dropped (worker queue full)\n",
+            c->requests, sending, c->requests / sending, dropped);
+    if (completed == 0) return;
+    qsort(latencies, completed, sizeof(unsigned long long), compare);
+    double mean_hold_us = total_hold_ns / 1e3 / completed;
+    printf("[LOADGEN] %d completed in %.2f s (%.1f grants/s), mean hold %.0f us\n",
+            completed, elapsed, completed / elapsed, mean_hold_us);
+    printf("[LOADGEN] time-to-grant: p50 %.0f us, p90 %.0f us, p99 %.0f us, p99.9 %.0f us, max %.0f us\n",
+            percentile(50), percentile(90), percentile(99), percentile(99.9), latencies[completed-1] / 1e3);
+    resource_class_t rc;
+    schedulerGetClass(scheduler, c->resource_class, &rc);
+    printf("[LOADGEN] offered load: %.2f resources busy on average, class %d has %d\n",
+            c->requests / sending * mean_hold_us / 1e6, c->resource_class, rc.capacity);
+
+    free(workers);
+    free(latencies);
+}
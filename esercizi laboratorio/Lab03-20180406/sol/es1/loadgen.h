@@ -0,0 +1,48 @@
+#ifndef __LOADGEN__
+#define __LOADGEN__
+
+#include "scheduler.h"
+#include "stats.h"
+
+/** Open-loop load generator for the scheduler (client -L <rate>).
+ *
+ * Requests arrive at the target rate whatever happens to the previous
+ * ones: with exponential inter-arrival times (Poisson arrivals) or at
+ * constant intervals. Each one is queued to a bounded pool of worker
+ * threads, which acquire a resource through the client's scheduler
+ * handle, hold it for a time drawn from the hold-time distribution and
+ * release it. If the queue of the pool is full the request is dropped
+ * and counted, the arrivals never slow down.
+ *
+ * Time-to-grant runs from the scheduled arrival, so the time spent
+ * waiting for a free worker counts too (no coordinated omission). The
+ * report gives its percentiles and the offered load, arrival rate
+ * times mean hold time, i.e. the resources busy on average: this is
+ * how many resources the server needs, plus a margin for the bursts.
+ **/
+#define ARRIVALS_POISSON    0
+#define ARRIVALS_CONSTANT   1
+
+#define HOLD_CONSTANT       0
+#define HOLD_EXPONENTIAL    1
+#define HOLD_UNIFORM        2   // between 0 and twice the mean
+
+#define LOADGEN_QUEUE       4096
+
+typedef struct {
+    double rate;            // requests per second
+    int arrivals;           // ARRIVALS_*
+    int requests;           // total requests to send
+    int workers;            // size of the pool
+    int hold;               // HOLD_*
+    double hold_us;         // mean hold time in microseconds
+    int resource_class;
+    int priority;
+} loadgen_config_t;
+
+int parseArrivals(const char* name);
+int parseHold(const char* name);
+
+void runLoadGenerator(scheduler_t* scheduler, stats_region_t* stats, loadgen_config_t* config);
+
+#endif
@@ -0,0 +1,101 @@
+#include "util.h"
+#include "ratelimiter.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define NUM_PROCESSES       4
+#define DURATION            2
+#define CLOCK_CHECK         1024    // calls between two looks at the clock
+
+/** Benchmark of the rate limiter: NUM_PROCESSES processes hammer the
+ * same bucket of the server for DURATION seconds, with the
+ * non-blocking try (default) or the blocking acquire (-B), and report
+ * how many calls per second the bucket sustains and how many were
+ * allowed, to be compared with the rate of the bucket.
+ *
+ * Start the server with a bucket first, e.g. ./server -b bench:100000:100 **/
+
+typedef struct {
+    unsigned long calls;
+    unsigned long allowed;
+} result_t;
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    int processes = NUM_PROCESSES, duration = DURATION, blocking = 0, opt;
+    char* name = "bench";
+    while ((opt = getopt(argc, argv, "b:p:t:B")) != -1) {
+        if (opt == 'b') name = optarg;
+        else if (opt == 'p' && (processes = atoi(optarg)) > 0) continue;
+        else if (opt == 't' && (duration = atoi(optarg)) > 0) continue;
+        else if (opt == 'B') blocking = 1;
+        else {
+            fprintf(stderr, "Syntax: %s [-b <bucket>] [-p <processes>] [-t <seconds>] [-B]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    ratelimiter_t* rl = ratelimiterOpen();
+    int bucket = ratelimiterFind(rl, name);
+    if (bucket == -1) {
+        fprintf(stderr, "No bucket %s: start the server with -b %s:<rate>[:<burst>]\n", name, name);
+        exit(EXIT_FAILURE);
+    }
+
+    // each child writes its counts in its own entry of a shared array
+    result_t* results = mmap(NULL, processes * sizeof(result_t), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) handle_error("mmap");
+
+    int i;
+    double start = now();
+    for (i = 0; i < processes; ++i) {
+        pid_t pid = fork();
+        if (pid == -1) handle_error("fork");
+        if (pid == 0) {
+            unsigned long calls = 0, allowed = 0;
+            double end = start + duration;
+            do {
+                int k;
+                for (k = 0; k < CLOCK_CHECK; ++k) {
+                    if (blocking) {
+                        ratelimiterAcquire(rl, bucket, 1);
+                        allowed++;
+                    } else {
+                        allowed += ratelimiterTryAcquire(rl, bucket, 1);
+                    }
+                }
+                calls += CLOCK_CHECK;
+            } while (now() < end);
+            results[i].calls = calls;
+            results[i].allowed = allowed;
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    for (i = 0; i < processes; ++i)
+        if (wait(NULL) == -1) handle_error("wait");
+    double elapsed = now() - start;
+
+    unsigned long calls = 0, allowed = 0;
+    for (i = 0; i < processes; ++i) {
+        calls += results[i].calls;
+        allowed += results[i].allowed;
+    }
+    printf("%d processes, %s on bucket %s (%.1f operations/s, bursts of %d) for %.2f s\n",
+            processes, blocking ? "blocking acquire" : "try-acquire", name,
+            rl->buckets[bucket].rate, rl->buckets[bucket].burst, elapsed);
+    printf("%lu calls (%.0f calls/s), %lu allowed (%.1f/s)\n",
+            calls, calls / elapsed, allowed, allowed / elapsed);
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include "ratelimiter.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "util.h"
+
+static unsigned long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static ratelimiter_t* mapRateLimiter(int fd) {
+    void* addr = mmap(NULL, sizeof(ratelimiter_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) handle_error("Could not map the rate limiter");
+    if (close(fd)) handle_error("Could not close the rate limiter");
+    return (ratelimiter_t*)addr;
+}
+
+ratelimiter_t* ratelimiterCreate() {
+    shm_unlink(RATE_SHM_NAME); // left behind by a server that crashed
+    int fd = shm_open(RATE_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) handle_error("Could not create the rate limiter");
+    if (ftruncate(fd, sizeof(ratelimiter_t))) handle_error("Could not size the rate limiter");
+    ratelimiter_t* rl = mapRateLimiter(fd);
+    rl->magic = RATE_MAGIC;
+    return rl;
+}
+
+void ratelimiterDestroy(ratelimiter_t* rl) {
+    ratelimiterClose(rl);
+    if (shm_unlink(RATE_SHM_NAME)) handle_error("Could not unlink the rate limiter");
+}
+
+ratelimiter_t* ratelimiterOpen() {
+    int fd = shm_open(RATE_SHM_NAME, O_RDWR, 0);
+    if (fd == -1) handle_error("Could not open the rate limiter (is the server running?)");
+    ratelimiter_t* rl = mapRateLimiter(fd);
+    if (rl->magic != RATE_MAGIC) handle_error_en(EINVAL, "Could not open the rate limiter");
+    return rl;
+}
+
+void ratelimiterClose(ratelimiter_t* rl) {
+    if (munmap(rl, sizeof(ratelimiter_t))) handle_error("Could not unmap the rate limiter");
+}
+
+int ratelimiterFind(ratelimiter_t* rl, const char* name) {
+    int i, n = __atomic_load_n(&rl->num_buckets, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; ++i)
+        if (__atomic_load_n(&rl->buckets[i].active, __ATOMIC_ACQUIRE) && strcmp(rl->buckets[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+// only the server changes the table, no need to lock against itself
+int ratelimiterSetBucket(ratelimiter_t* rl, const char* name, double rate, int burst) {
+    if (strlen(name) >= BUCKET_NAME_LEN) return -1;
+    int i = ratelimiterFind(rl, name);
+    if (i == -1) {
+        if (rl->num_buckets == MAX_BUCKETS) return -1;
+        i = rl->num_buckets;
+        strcpy(rl->buckets[i].name, name);
+    }
+    bucket_t* b = &rl->buckets[i];
+    b->rate = rate;
+    b->burst = burst;
+    __atomic_store_n(&b->interval_ns, (unsigned long long)(1e9 / rate), __ATOMIC_RELAXED);
+    __atomic_store_n(&b->tolerance_ns, (unsigned long long)(1e9 / rate) * burst, __ATOMIC_RELAXED);
+    if (!b->active) {
+        __atomic_store_n(&b->active, 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&rl->num_buckets, i + 1, __ATOMIC_RELEASE);
+    }
+    return i;
+}
+
+int ratelimiterTryAcquire(ratelimiter_t* rl, int bucket, int tokens) {
+    bucket_t* b = &rl->buckets[bucket];
+    unsigned long long now = nowNs();
+    unsigned long long cost = tokens * __atomic_load_n(&b->interval_ns, __ATOMIC_RELAXED);
+    unsigned long long limit = now + __atomic_load_n(&b->tolerance_ns, __ATOMIC_RELAXED);
+    unsigned long long tat = __atomic_load_n(&b->tat, __ATOMIC_RELAXED);
+    unsigned long long next;
+    do {
+        next = ((tat > now) ? tat : now) + cost;
+        if (next > limit) return 0;
+    } while (!__atomic_compare_exchange_n(&b->tat, &tat, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return 1;
+}
+
+void ratelimiterAcquire(ratelimiter_t* rl, int bucket, int tokens) {
+    bucket_t* b = &rl->buckets[bucket];
+    unsigned long long now = nowNs();
+    unsigned long long cost = tokens * __atomic_load_n(&b->interval_ns, __ATOMIC_RELAXED);
+    unsigned long long tat = __atomic_load_n(&b->tat, __ATOMIC_RELAXED);
+    unsigned long long next;
+    do {
+        next = ((tat > now) ? tat : now) + cost;
+    } while (!__atomic_compare_exchange_n(&b->tat, &tat, next, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // our tokens are available when next is within the tolerance
+    unsigned long long tolerance = __atomic_load_n(&b->tolerance_ns, __ATOMIC_RELAXED);
+    if (next <= now + tolerance) return;
+    unsigned long long when = next - tolerance;
+    struct timespec t = { when / 1000000000ULL, when % 1000000000ULL };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR)
+        continue;
+}
+
+double ratelimiterAvailable(ratelimiter_t* rl, int bucket) {
+    bucket_t* b = &rl->buckets[bucket];
+    unsigned long long now = nowNs();
+    unsigned long long tat = __atomic_load_n(&b->tat, __ATOMIC_RELAXED);
+    unsigned long long limit = now + b->tolerance_ns;
+    if (tat < now) tat = now;
+    return (tat >= limit) ? 0 : (double)(limit - tat) / b->interval_ns;
+}
@@ -0,0 +1,69 @@
+#ifndef __RATELIMITER__
+#define __RATELIMITER__
+
+/** Named token buckets in a shared-memory segment created by the
+ * server, for processes sharing a budget of operations per second
+ * rather than a number of resources held at the same time.
+ *
+ * Each bucket implements the generic cell rate algorithm: instead of a
+ * token count refilled by somebody, it keeps a single word, the
+ * theoretical arrival time (TAT) of the next operation on the
+ * CLOCK_MONOTONIC time line. Taking n tokens at time now moves it to
+ * max(TAT, now) + n * interval, and is allowed if the result is no
+ * further than burst * interval ahead of now. The refill is implicit
+ * in the passing of time, and taking tokens is a single
+ * compare-and-swap on the TAT: no lock, no thread, and a rejected try
+ * does not even write to the shared cache line.
+ *
+ * The blocking acquire reserves its tokens with the same CAS whether
+ * or not they are available yet, then sleeps until their time comes:
+ * waiters are served in reservation order without retrying.
+ **/
+#define RATE_SHM_NAME       "/simple_scheduler_rates"
+#define RATE_MAGIC          0x52415445
+#define MAX_BUCKETS         16
+#define BUCKET_NAME_LEN     32
+
+typedef struct {
+    unsigned long long tat;         // ns, CAS'ed by the clients
+    unsigned long long interval_ns; // 1 s / rate
+    unsigned long long tolerance_ns;// burst * interval_ns
+    int active;                     // set once name and parameters are in place
+    int burst;
+    double rate;
+    char name[BUCKET_NAME_LEN];
+} __attribute__((aligned(64))) bucket_t;
+
+typedef struct {
+    int magic;
+    int num_buckets;
+    bucket_t buckets[MAX_BUCKETS];
+} ratelimiter_t;
+
+// server: creates (replacing a stale one) and removes the segment
+ratelimiter_t* ratelimiterCreate();
+void ratelimiterDestroy(ratelimiter_t* rl);
+
+/** Server: creates the bucket, or changes rate and burst of an existing
+ * one. Returns its index, -1 if the table is full or the name too long.
+ * Clients racing with a change may see the old interval with the new
+ * tolerance for a moment: the limit is right again at the next call. **/
+int ratelimiterSetBucket(ratelimiter_t* rl, const char* name, double rate, int burst);
+
+// clients: map the segment created by the server
+ratelimiter_t* ratelimiterOpen();
+void ratelimiterClose(ratelimiter_t* rl);
+
+// index of the bucket, -1 if there is no such bucket
+int ratelimiterFind(ratelimiter_t* rl, const char* name);
+
+// 1 if the tokens were taken, 0 if not available now (never if tokens > burst)
+int ratelimiterTryAcquire(ratelimiter_t* rl, int bucket, int tokens);
+
+// takes the tokens, sleeping until they are available
+void ratelimiterAcquire(ratelimiter_t* rl, int bucket, int tokens);
+
+// tokens that could be taken now
+double ratelimiterAvailable(ratelimiter_t* rl, int bucket);
+
+#endif
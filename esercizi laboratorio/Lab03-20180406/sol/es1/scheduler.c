@@ -0,0 +1,220 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "util.h"
+
+static unsigned long long nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// not FUTEX_PRIVATE: the waiter and the waker are different processes
+static void futexWait(int* addr, int val) {
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, val, NULL, NULL, 0) == -1 && errno != EAGAIN && errno != EINTR)
+        handle_error("futex wait");
+}
+
+static void futexWake(int* addr) {
+    if (syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0) == -1) handle_error("futex wake");
+}
+
+static void lock(scheduler_t* s) {
+    int ret = pthread_mutex_lock(&s->lock);
+    // a client died holding the lock: the table is only changed as a
+    // whole while holding it, so it is still consistent
+    if (ret == EOWNERDEAD) ret = pthread_mutex_consistent(&s->lock);
+    if (ret) handle_error_en(ret, "Could not lock the scheduler");
+}
+
+static void unlock(scheduler_t* s) {
+    pthread_mutex_unlock(&s->lock);
+}
+
+static scheduler_t* mapScheduler(int fd) {
+    void* addr = mmap(NULL, sizeof(scheduler_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) handle_error("Could not map the scheduler");
+    if (close(fd)) handle_error("Could not close the scheduler");
+    return (scheduler_t*)addr;
+}
+
+scheduler_t* schedulerCreate(int numClasses, const int* capacities, int quota, int aging_ms) {
+    shm_unlink(SCHED_SHM_NAME); // left behind by a server that crashed
+    int fd = shm_open(SCHED_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) handle_error("Could not create the scheduler");
+    if (ftruncate(fd, sizeof(scheduler_t))) handle_error("Could not size the scheduler");
+    scheduler_t* s = mapScheduler(fd);
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int ret = pthread_mutex_init(&s->lock, &attr);
+    if (ret) handle_error_en(ret, "Could not initialize the scheduler lock");
+    pthread_mutexattr_destroy(&attr);
+
+    int i;
+    s->num_classes = numClasses;
+    for (i = 0; i < numClasses; ++i)
+        s->classes[i].capacity = capacities[i];
+    s->quota = quota;
+    s->aging_ms = aging_ms;
+    s->magic = SCHED_MAGIC;
+    return s;
+}
+
+void schedulerDestroy(scheduler_t* s) {
+    schedulerClose(s);
+    if (shm_unlink(SCHED_SHM_NAME)) handle_error("Could not unlink the scheduler");
+}
+
+scheduler_t* schedulerOpen() {
+    int fd = shm_open(SCHED_SHM_NAME, O_RDWR, 0);
+    if (fd == -1) handle_error("Could not open the scheduler (is the server running?)");
+    scheduler_t* s = mapScheduler(fd);
+    if (s->magic != SCHED_MAGIC) handle_error_en(EINVAL, "Could not open the scheduler");
+    return s;
+}
+
+void schedulerClose(scheduler_t* s) {
+    if (munmap(s, sizeof(scheduler_t))) handle_error("Could not unmap the scheduler");
+}
+
+// entry of the client, created if needed; NULL if the table is full
+static client_t* findClient(scheduler_t* s, pid_t pid, int create) {
+    int i;
+    client_t* free_entry = NULL;
+    for (i = 0; i < MAX_CLIENTS; ++i) {
+        client_t* c = &s->clients[i];
+        if (c->pid == pid) return c;
+        // entries of clients holding and waiting for nothing are reusable
+        if (free_entry == NULL && (c->pid == 0 || (c->held == 0 && c->waiting == 0)))
+            free_entry = c;
+    }
+    if (create && free_entry != NULL) {
+        free_entry->pid = pid;
+        free_entry->held = free_entry->waiting = 0;
+    }
+    return create ? free_entry : NULL;
+}
+
+/** Grants the free resources of the class, one waiter at a time, to the
+ * best eligible waiter. To be called holding the lock. **/
+static void dispatch(scheduler_t* s, int class) {
+    resource_class_t* c = &s->classes[class];
+    unsigned long long now = nowNs();
+    while (c->in_use < c->capacity && c->waiting > 0) {
+        waiter_t* best = NULL;
+        client_t* best_client = NULL;
+        long long best_priority = 0;
+        int i, seen = 0;
+        for (i = 0; i < MAX_WAITERS && seen < c->waiting; ++i) {
+            waiter_t* w = &s->waiters[i];
+            if (w->state != WAITER_WAITING || w->class != class) continue;
+            ++seen;
+            client_t* client = findClient(s, w->pid, 0);
+            if (s->quota && client->held >= s->quota) continue;
+            long long priority = w->priority + (long long)((now - w->since_ns) / 1000000) / s->aging_ms;
+            if (best == NULL || priority > best_priority ||
+                    (priority == best_priority && w->ticket < best->ticket)) {
+                best = w;
+                best_client = client;
+                best_priority = priority;
+            }
+        }
+        if (best == NULL) break; // the waiters left are over quota
+
+        c->in_use++;
+        c->waiting--;
+        c->grants++;
+        best_client->held++;
+        best_client->waiting--;
+        __atomic_store_n(&best->state, WAITER_GRANTED, __ATOMIC_RELEASE);
+        futexWake(&best->state);
+    }
+}
+
+int schedulerAcquire(scheduler_t* s, int class, int priority) {
+    if (class < 0 || class >= s->num_classes || priority < 0 || priority >= NUM_PRIORITIES) {
+        errno = EINVAL;
+        return -1;
+    }
+    lock(s);
+    int i;
+    waiter_t* w = NULL;
+    for (i = 0; i < MAX_WAITERS && w == NULL; ++i)
+        if (s->waiters[i].state == WAITER_FREE) w = &s->waiters[i];
+    client_t* client = findClient(s, getpid(), 1);
+    if (w == NULL || client == NULL) {
+        unlock(s);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // always through the queue: we get the resource at once only if
+    // nobody with a better claim is waiting
+    w->class = class;
+    w->priority = priority;
+    w->pid = getpid();
+    w->ticket = s->next_ticket++;
+    w->since_ns = nowNs();
+    w->state = WAITER_WAITING;
+    s->classes[class].waiting++;
+    client->waiting++;
+    dispatch(s, class);
+    unlock(s);
+
+    while (__atomic_load_n(&w->state, __ATOMIC_ACQUIRE) == WAITER_WAITING)
+        futexWait(&w->state, WAITER_WAITING);
+    // the entry is ours until we give it back
+    __atomic_store_n(&w->state, WAITER_FREE, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void schedulerRelease(scheduler_t* s, int class) {
+    lock(s);
+    client_t* client = findClient(s, getpid(), 0);
+    if (client != NULL && client->held > 0) client->held--;
+    s->classes[class].in_use--;
+    if (s->quota) {
+        // a waiter of ours of another class may be eligible now
+        int i;
+        for (i = 0; i < s->num_classes; ++i)
+            dispatch(s, i);
+    } else {
+        dispatch(s, class);
+    }
+    unlock(s);
+}
+
+void schedulerSetCapacity(scheduler_t* s, int class, int capacity) {
+    lock(s);
+    s->classes[class].capacity = capacity;
+    dispatch(s, class);
+    unlock(s);
+}
+
+void schedulerSetQuota(scheduler_t* s, int quota) {
+    lock(s);
+    s->quota = quota;
+    int i;
+    for (i = 0; i < s->num_classes; ++i)
+        dispatch(s, i);
+    unlock(s);
+}
+
+void schedulerGetClass(scheduler_t* s, int class, resource_class_t* out) {
+    lock(s);
+    *out = s->classes[class];
+    unlock(s);
+}
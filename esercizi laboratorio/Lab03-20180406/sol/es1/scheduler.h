@@ -0,0 +1,96 @@
+#ifndef __SCHEDULER__
+#define __SCHEDULER__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+/** A fair resource scheduler in a shared-memory segment created by the
+ * server, replacing the counting named semaphore: POSIX semaphores do
+ * not wake their waiters in any particular order, so under load a
+ * client can wait forever.
+ *
+ * Resources come in up to MAX_CLASSES classes, each with its own
+ * capacity, which the server can change at run time. A client asks for
+ * a resource of a class with a priority (0 lowest). Every request gets
+ * a ticket and an entry in the waiter table; whenever a resource may
+ * be free the scheduler grants it, among the waiters of its class, to
+ * the one with the highest effective priority, i.e. its priority plus
+ * one level per aging_ms spent waiting (so low priorities cannot
+ * starve), and the smallest ticket among equals (FIFO). A waiter whose
+ * client (process) already holds quota resources is skipped until the
+ * client releases one.
+ *
+ * The table is protected by a robust process-shared mutex. A waiter
+ * sleeps on the futex word of its own entry, and the releaser wakes
+ * exactly the waiter it granted the resource to: no thundering herd.
+ * As with the semaphore, a client that dies holding a resource does
+ * not give it back.
+ **/
+#define SCHED_SHM_NAME      "/simple_scheduler_queue"
+#define SCHED_MAGIC         0x53434844
+#define MAX_CLASSES         4
+#define NUM_PRIORITIES      4
+#define MAX_WAITERS         1024
+#define MAX_CLIENTS         256
+#define AGING_MS            1000
+
+#define WAITER_FREE         0
+#define WAITER_WAITING      1
+#define WAITER_GRANTED      2
+
+typedef struct {
+    int state;                  // futex word, WAITER_*
+    int class;
+    int priority;
+    pid_t pid;
+    unsigned long long ticket;
+    unsigned long long since_ns;
+} waiter_t;
+
+typedef struct {
+    pid_t pid;                  // 0 for a free entry
+    int held;
+    int waiting;
+} client_t;
+
+typedef struct {
+    int capacity;
+    int in_use;
+    int waiting;
+    unsigned long grants;
+} resource_class_t;
+
+typedef struct {
+    int magic;
+    pthread_mutex_t lock;
+    int num_classes;
+    int quota;                  // resources per client, 0 unlimited
+    int aging_ms;
+    unsigned long long next_ticket;
+    resource_class_t classes[MAX_CLASSES];
+    client_t clients[MAX_CLIENTS];
+    waiter_t waiters[MAX_WAITERS];
+} scheduler_t;
+
+// server: creates (replacing a stale one) and removes the segment
+scheduler_t* schedulerCreate(int numClasses, const int* capacities, int quota, int aging_ms);
+void schedulerDestroy(scheduler_t* s);
+
+// clients: map the segment created by the server
+scheduler_t* schedulerOpen();
+void schedulerClose(scheduler_t* s);
+
+/** Blocks until a resource of the class is granted. Returns 0, or -1
+ * with errno EINVAL (bad class or priority) or EAGAIN (the waiter or
+ * the client table is full). **/
+int schedulerAcquire(scheduler_t* s, int class, int priority);
+void schedulerRelease(scheduler_t* s, int class);
+
+// server, at run time: waiters are granted at once if capacity grows
+void schedulerSetCapacity(scheduler_t* s, int class, int capacity);
+void schedulerSetQuota(scheduler_t* s, int quota);
+
+// consistent copy of a class, for the server's log
+void schedulerGetClass(scheduler_t* s, int class, resource_class_t* out);
+
+#endif
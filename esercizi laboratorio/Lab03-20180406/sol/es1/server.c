@@ -1,68 +1,193 @@
 #include "util.h"
+#include "stats.h"
+#include "scheduler.h"
+#include "ratelimiter.h"
 
 #include <errno.h>
-#include <fcntl.h>  // O_CREAT and O_EXCL flags
-#include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/select.h>
 
 #define LOG_INTERVAL        1
 #define NUM_RESOURCES       3
-#define SEMAPHORE_NAME      "/simple_scheduler"
+#define SNAPSHOT_FILE       "scheduler_stats.json"
 
-// we use a global variable to store a pointer to the named semaphore
-sem_t* named_semaphore;
+// the scheduler shared with the clients, see scheduler.h
+scheduler_t* scheduler;
+
+// statistics recorded by the clients, see stats.h
+stats_region_t* stats;
+
+// token buckets shared with the clients, see ratelimiter.h
+ratelimiter_t* ratelimiter;
+
+void printHistogram(const char* title, const unsigned long* hist) {
+    printf("%s\n", title);
+    int k;
+    for (k = 0; k < STATS_BUCKETS; ++k)
+        if (hist[k]) printf("  < %10lu us: %lu\n", 2UL << k, hist[k]);
+}
+
+void printHistogramJSON(FILE* f, const char* name, const unsigned long* hist) {
+    int k;
+    fprintf(f, "  \"%s\": [", name);
+    for (k = 0; k < STATS_BUCKETS; ++k)
+        fprintf(f, "%s%lu", k ? ", " : "", hist[k]);
+    fprintf(f, "],\n");
+}
+
+/** The snapshot is written to a temporary file and renamed over the
+ * old one, so that a reader never sees a half-written snapshot. **/
+void writeSnapshot(time_t now, double elapsed, stats_totals_t* t, stats_totals_t* interval) {
+    FILE* f = fopen(SNAPSHOT_FILE ".tmp", "w");
+    if (f == NULL) handle_error("Could not write the snapshot");
+    fprintf(f, "{\n  \"time\": %ld,\n  \"interval_s\": %.3f,\n", (long)now, elapsed);
+    fprintf(f, "  \"quota\": %d,\n  \"classes\": [", scheduler->quota);
+    int i;
+    for (i = 0; i < scheduler->num_classes; ++i) {
+        resource_class_t c;
+        schedulerGetClass(scheduler, i, &c);
+        fprintf(f, "%s\n    {\"capacity\": %d, \"in_use\": %d, \"waiting\": %d, \"grants\": %lu}",
+                i ? "," : "", c.capacity, c.in_use, c.waiting, c.grants);
+    }
+    fprintf(f, "\n  ],\n  \"buckets\": [");
+    for (i = 0; i < ratelimiter->num_buckets; ++i) {
+        bucket_t* b = &ratelimiter->buckets[i];
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"rate\": %.1f, \"burst\": %d, \"available\": %.1f}",
+                i ? "," : "", b->name, b->rate, b->burst, ratelimiterAvailable(ratelimiter, i));
+    }
+    fprintf(f, "\n  ],\n");
+    fprintf(f, "  \"queue_depth\": %lu,\n  \"peak_queue_depth\": %d,\n",
+            t->requests - t->grants, t->peak_waiting);
+    fprintf(f, "  \"requests\": %lu,\n  \"grants\": %lu,\n  \"releases\": %lu,\n",
+            t->requests, t->grants, t->releases);
+    fprintf(f, "  \"grants_per_s\": %.1f,\n  \"releases_per_s\": %.1f,\n",
+            interval->grants / elapsed, interval->releases / elapsed);
+    fprintf(f, "  \"histogram_bucket_us\": \"bucket k counts durations below 2^(k+1) us, since the server started\",\n");
+    printHistogramJSON(f, "wait_histogram", t->wait_hist);
+    printHistogramJSON(f, "hold_histogram", t->hold_hist);
+    fprintf(f, "  \"wait_avg_us\": %.1f,\n  \"hold_avg_us\": %.1f\n}\n",
+            t->grants ? t->wait_ns / 1e3 / t->grants : 0.0,
+            t->releases ? t->hold_ns / 1e3 / t->releases : 0.0);
+    if (fclose(f) == EOF) handle_error("Could not write the snapshot");
+    if (rename(SNAPSHOT_FILE ".tmp", SNAPSHOT_FILE)) handle_error("Could not rename the snapshot");
+}
+
+/** Commands typed on the server's console while it runs:
+ *    resources <class> <n>   changes the capacity of a class
+ *    quota <n>               resources per client, 0 for no limit
+ *    bucket <name> <rate> <burst>  creates or changes a token bucket **/
+void setBucket(const char* name, double rate, int burst) {
+    if (rate <= 0 || burst < 1 || ratelimiterSetBucket(ratelimiter, name, rate, burst) == -1)
+        printf("Could not set bucket %s (at most %d buckets, names shorter than %d characters)\n",
+                name, MAX_BUCKETS, BUCKET_NAME_LEN);
+    else
+        printf("Bucket %s: %.1f operations/s, bursts of %d\n", name, rate, burst);
+}
+
+void runCommand(char* line) {
+    int class, n;
+    char name[BUCKET_NAME_LEN];
+    double rate;
+    if (sscanf(line, "bucket %31s %lf %d", name, &rate, &n) == 3) {
+        setBucket(name, rate, n);
+    } else if (sscanf(line, "resources %d %d", &class, &n) == 2 && class >= 0 &&
+            class < scheduler->num_classes && n >= 0) {
+        schedulerSetCapacity(scheduler, class, n);
+        printf("Class %d has now %d resources\n", class, n);
+    } else if (sscanf(line, "quota %d", &n) == 1 && n >= 0) {
+        schedulerSetQuota(scheduler, n);
+        printf("Each client can now hold %d resources (0: no limit)\n", n);
+    } else if (line[0] != '\n') {
+        printf("Commands: resources <class> <n>, quota <n>, bucket <name> <rate> <burst>\n");
+    }
+}
 
 void cleanup() {
-    /** Close and then unlink the named semaphore **/
     printf("\rShutting down the server...\n");
 
-    if (sem_close(named_semaphore)) handle_error("sem_close error");
-
-    /* We unlink the semaphore, otherwise it would remain in the
+    /* We unlink the scheduler, otherwise it would remain in the
      * system after the server dies. */
-    if (sem_unlink(SEMAPHORE_NAME)) handle_error("sem_unlink error");
+    schedulerDestroy(scheduler);
+    ratelimiterDestroy(ratelimiter);
+
+    /* Print the histograms since the server started and remove the
+     * statistics too. */
+    stats_totals_t totals;
+    statsCollect(stats, &totals);
+    printHistogram("Queue-wait histogram:", totals.wait_hist);
+    printHistogram("Hold-time histogram:", totals.hold_hist);
+    statsDestroy(stats);
 
     exit(0);
 }
 
 int main(int argc, char* argv[]) {
-    int ret;
-
-    /** Create a named semaphore to be shared with different processes.
-     *
-     * O_CREAT tells the system to create the semaphore named SEMAPHORE_NAMED
-     * if it does not already exist. When used in an OR combination with
-     * O_EXCL, the call fails if the semaphore already exists.
-     *
-     * Mode 0600 means that only the processes owned by the user that creates
-     * the semaphore can access it, with read & write (4+2) permissions.
-     *
-     * We initialize the semaphore with a value equal to NUM_RESOURCES.
-     **/
-
-
-    /* If the semaphore was already created we need first to unlink it. In this case
-    * we don’t need to handle the error
-    **/
-
-    sem_unlink(SEMAPHORE_NAME);
-    named_semaphore = sem_open(SEMAPHORE_NAME, O_CREAT | O_EXCL, 0600, NUM_RESOURCES);
-
-    if (named_semaphore == SEM_FAILED) {
-        handle_error("Could not open the named semaphore");
+    /** -r gives the capacities of the resource classes, e.g. -r 3,1 for
+     * two classes, -q the resources a client can hold at the same time
+     * (0: no limit) and -a the milliseconds after which a waiting
+     * client gains a priority level. -b name:rate[:burst] creates a
+     * token bucket (operations per second, bursts of 1 by default) and
+     * can be repeated. **/
+    int capacities[MAX_CLASSES] = { NUM_RESOURCES };
+    int numClasses = 1, quota = 0, aging_ms = AGING_MS, opt, numBuckets = 0;
+    char* token;
+    char* buckets[MAX_BUCKETS];
+    while ((opt = getopt(argc, argv, "r:q:a:b:")) != -1) {
+        if (opt == 'r') {
+            for (numClasses = 0, token = strtok(optarg, ","); token != NULL; token = strtok(NULL, ",")) {
+                if (numClasses == MAX_CLASSES || (capacities[numClasses++] = atoi(token)) < 0) break;
+            }
+            if (token == NULL && numClasses > 0) continue;
+        } else if (opt == 'q' && (quota = atoi(optarg)) >= 0) {
+            continue;
+        } else if (opt == 'a' && (aging_ms = atoi(optarg)) > 0) {
+            continue;
+        } else if (opt == 'b' && numBuckets < MAX_BUCKETS && strchr(optarg, ':') != NULL) {
+            buckets[numBuckets++] = optarg;
+            continue;
+        }
+        fprintf(stderr, "Syntax: %s [-r <resources>[,<resources>...]] [-q <quota>] [-a <aging ms>] "
+                "[-b <name>:<rate>[:<burst>]]...\n(at most %d classes and %d buckets)\n",
+                argv[0], MAX_CLASSES, MAX_BUCKETS);
+        exit(EXIT_FAILURE);
     }
 
+    /** Create the scheduler in a shared-memory segment, replacing the
+     * one left behind by a previous server if needed. **/
+    scheduler = schedulerCreate(numClasses, capacities, quota, aging_ms);
+
+    /** The token buckets live in a segment of their own: a rate
+     * limited client has no business with the scheduler's table. **/
+    ratelimiter = ratelimiterCreate();
+
+    /* The clients record their events in a shared-memory segment, so
+     * the server sees what happens between two log lines too. */
+    stats = statsCreate();
+    stats_totals_t totals, previous, interval;
+    memset(&previous, 0, sizeof(previous));
+    unsigned long long previous_ns = statsNow();
+
     /* Since a CTRL+C would kill the program, we rely on an auxiliary
      * method to catch the interrupt and executed a cleanup code before
      * terminating the program. */
     setQuitHandler(&cleanup);
 
     printf("Welcome! This is the server module of our simple resource scheduler.\n\n");
-    printf("%d resources are initially available in the system. Use CTRL+C to exit!\n\n", NUM_RESOURCES);
+    int i;
+    for (i = 0; i < numClasses; ++i)
+        printf("%d resources of class %d are initially available in the system.\n", capacities[i], i);
+    for (i = 0; i < numBuckets; ++i) {
+        char* name = strtok(buckets[i], ":");
+        char* rate = strtok(NULL, ":");
+        char* burst = strtok(NULL, ":");
+        setBucket(name, rate ? atof(rate) : 0, burst ? atoi(burst) : 1);
+    }
+    printf("Type \"resources <class> <n>\", \"quota <n>\" or \"bucket <name> <rate> <burst>\" to change them. "
+            "Use CTRL+C to exit!\n\n");
 
     /* Main loop */
     while(1) {
@@ -73,20 +198,48 @@ int main(int argc, char* argv[]) {
         // get a timestamp of the form "HH:MM:SS" and store it into a buffer
         strftime((char*)timestamp, 9, "%H:%M:%S", localtime(&now));
 
-        /** Get the current value for the semaphore and store it into a
-         * custom local variable (we pass its address through &). The
-         * value of the semaphore is the number of resources not in use. **/
-        int current_value;
-        ret = sem_getvalue(named_semaphore, &current_value);
-
-        if (ret) {
-            handle_error("Could not access the named semaphore");
-            exit(1);
+        for (i = 0; i < numClasses; ++i) {
+            resource_class_t c;
+            schedulerGetClass(scheduler, i, &c);
+            printf("[%s] class %d: %d resources are available and %d are in use, %d clients waiting\n",
+                    timestamp, i, (c.capacity > c.in_use) ? c.capacity - c.in_use : 0, c.in_use, c.waiting);
         }
 
-        printf("[%s] %d resources are available and %d are in use\n", timestamp, current_value, NUM_RESOURCES - current_value);
-
-        sleep(LOG_INTERVAL);
+        for (i = 0; i < ratelimiter->num_buckets; ++i)
+            printf("[%s] bucket %s: %.1f of %d tokens available (%.1f operations/s)\n", timestamp,
+                    ratelimiter->buckets[i].name, ratelimiterAvailable(ratelimiter, i),
+                    ratelimiter->buckets[i].burst, ratelimiter->buckets[i].rate);
+
+        /** Events since the previous line, over the time actually
+         * elapsed: a console command ends the wait early. The queue
+         * depth is exact, the peak catches the bursts that came and
+         * went meanwhile, the percentiles are those of the interval. **/
+        statsCollect(stats, &totals);
+        unsigned long long now_ns = statsNow();
+        double elapsed = (now_ns - previous_ns) / 1e9;
+        statsInterval(&totals, &previous, &interval);
+        printf("           %lu waiting (peak %d), %.1f grants/s, %.1f releases/s, "
+                "wait p50 < %lu us p99 < %lu us, hold p50 < %lu us p99 < %lu us\n",
+                totals.requests - totals.grants, totals.peak_waiting,
+                interval.grants / elapsed, interval.releases / elapsed,
+                statsPercentile(interval.wait_hist, 50), statsPercentile(interval.wait_hist, 99),
+                statsPercentile(interval.hold_hist, 50), statsPercentile(interval.hold_hist, 99));
+        writeSnapshot(now, elapsed, &totals, &interval);
+        previous_ns = now_ns;
+        previous = totals;
+
+        /** Instead of sleeping, wait up to LOG_INTERVAL for a command. **/
+        struct timeval timeout = { LOG_INTERVAL, 0 };
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+        int ret = select(STDIN_FILENO + 1, &fds, NULL, NULL, &timeout);
+        if (ret == -1 && errno != EINTR) handle_error("select");
+        if (ret > 0) {
+            char line[128];
+            if (fgets(line, sizeof(line), stdin) != NULL) runCommand(line);
+            else sleep(LOG_INTERVAL);   // stdin closed, e.g. running in background
+        }
     }
 
     /*** We will never reach this point since we want to exit the program through CTRL+C only! ***/
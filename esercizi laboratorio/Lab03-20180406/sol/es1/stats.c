@@ -0,0 +1,143 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "util.h"
+
+static stats_region_t* mapRegion(int fd) {
+    void* addr = mmap(NULL, sizeof(stats_region_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) handle_error("Could not map the statistics");
+    if (close(fd)) handle_error("Could not close the statistics");
+    return (stats_region_t*)addr;
+}
+
+stats_region_t* statsCreate() {
+    shm_unlink(STATS_SHM_NAME); // left behind by a server that crashed
+    int fd = shm_open(STATS_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) handle_error("Could not create the statistics");
+    // a new segment is zero-filled: all the counters start from 0
+    if (ftruncate(fd, sizeof(stats_region_t))) handle_error("Could not size the statistics");
+    stats_region_t* stats = mapRegion(fd);
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+void statsDestroy(stats_region_t* stats) {
+    statsClose(stats);
+    if (shm_unlink(STATS_SHM_NAME)) handle_error("Could not unlink the statistics");
+}
+
+stats_region_t* statsOpen() {
+    int fd = shm_open(STATS_SHM_NAME, O_RDWR, 0);
+    if (fd == -1) handle_error("Could not open the statistics (is the server running?)");
+    stats_region_t* stats = mapRegion(fd);
+    if (stats->magic != STATS_MAGIC) handle_error_en(EINVAL, "Could not open the statistics");
+    return stats;
+}
+
+void statsClose(stats_region_t* stats) {
+    if (munmap(stats, sizeof(stats_region_t))) handle_error("Could not unmap the statistics");
+}
+
+unsigned long long statsNow() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+int statsSlot(int threadID) {
+    return (unsigned)(getpid() * 31 + threadID) % STATS_SLOTS;
+}
+
+static int bucket(unsigned long long ns) {
+    unsigned long long us = ns / 1000;
+    int k = 0;
+    while (us > 1 && k < STATS_BUCKETS-1) {
+        us >>= 1;
+        ++k;
+    }
+    return k;
+}
+
+void statsRequest(stats_region_t* stats, int slot) {
+    __atomic_fetch_add(&stats->slots[slot].requests, 1, __ATOMIC_RELAXED);
+    int waiting = __atomic_add_fetch(&stats->waiting, 1, __ATOMIC_RELAXED);
+    int peak = __atomic_load_n(&stats->peak_waiting, __ATOMIC_RELAXED);
+    while (waiting > peak && !__atomic_compare_exchange_n(&stats->peak_waiting, &peak, waiting,
+                1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        continue; // peak has been reloaded by the failed exchange
+}
+
+void statsGranted(stats_region_t* stats, int slot, unsigned long long wait_ns) {
+    stats_slot_t* s = &stats->slots[slot];
+    __atomic_fetch_sub(&stats->waiting, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->wait_ns, wait_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->wait_hist[bucket(wait_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->grants, 1, __ATOMIC_RELAXED);
+}
+
+void statsReleased(stats_region_t* stats, int slot, unsigned long long hold_ns) {
+    stats_slot_t* s = &stats->slots[slot];
+    __atomic_fetch_add(&s->hold_ns, hold_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->hold_hist[bucket(hold_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->releases, 1, __ATOMIC_RELAXED);
+}
+
+void statsCollect(stats_region_t* stats, stats_totals_t* totals) {
+    memset(totals, 0, sizeof(stats_totals_t));
+    // the peak of the next interval starts from the clients waiting now
+    totals->peak_waiting = __atomic_exchange_n(&stats->peak_waiting,
+            __atomic_load_n(&stats->waiting, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+
+    int i, k;
+    for (i = 0; i < STATS_SLOTS; ++i) {
+        stats_slot_t* s = &stats->slots[i];
+        totals->requests += __atomic_load_n(&s->requests, __ATOMIC_RELAXED);
+        totals->grants += __atomic_load_n(&s->grants, __ATOMIC_RELAXED);
+        totals->releases += __atomic_load_n(&s->releases, __ATOMIC_RELAXED);
+        totals->wait_ns += __atomic_load_n(&s->wait_ns, __ATOMIC_RELAXED);
+        totals->hold_ns += __atomic_load_n(&s->hold_ns, __ATOMIC_RELAXED);
+        for (k = 0; k < STATS_BUCKETS; ++k) {
+            totals->wait_hist[k] += __atomic_load_n(&s->wait_hist[k], __ATOMIC_RELAXED);
+            totals->hold_hist[k] += __atomic_load_n(&s->hold_hist[k], __ATOMIC_RELAXED);
+        }
+    }
+    /* The slots are read one at a time while clients go on: a grant can
+     * be counted before its request. Never report a negative depth. */
+    if (totals->grants > totals->requests) totals->grants = totals->requests;
+    if (totals->releases > totals->grants) totals->releases = totals->grants;
+}
+
+void statsInterval(const stats_totals_t* totals, const stats_totals_t* previous, stats_totals_t* interval) {
+    int k;
+    interval->requests = totals->requests - previous->requests;
+    interval->grants = totals->grants - previous->grants;
+    interval->releases = totals->releases - previous->releases;
+    interval->wait_ns = totals->wait_ns - previous->wait_ns;
+    interval->hold_ns = totals->hold_ns - previous->hold_ns;
+    for (k = 0; k < STATS_BUCKETS; ++k) {
+        interval->wait_hist[k] = totals->wait_hist[k] - previous->wait_hist[k];
+        interval->hold_hist[k] = totals->hold_hist[k] - previous->hold_hist[k];
+    }
+    interval->peak_waiting = totals->peak_waiting;
+}
+
+unsigned long statsPercentile(const unsigned long* hist, double percentile) {
+    unsigned long total = 0, seen = 0;
+    int k;
+    for (k = 0; k < STATS_BUCKETS; ++k)
+        total += hist[k];
+    if (total == 0) return 0;
+    for (k = 0; k < STATS_BUCKETS; ++k) {
+        seen += hist[k];
+        if (seen >= total * percentile / 100) break;
+    }
+    return 2UL << k;
+}
@@ -0,0 +1,80 @@
+#ifndef __STATS__
+#define __STATS__
+
+/** Event-driven statistics of the scheduler in a shared-memory segment.
+ *
+ * Sampling sem_getvalue() once per second does not show what happens
+ * in between. Instead, every client records three events: the request
+ * of a resource (before schedulerAcquire), its grant (when
+ * schedulerAcquire returns) and its release (after schedulerRelease). Queue-wait time (grant - request) and hold
+ * time (release - grant) go into log2 histograms.
+ *
+ * Counters are spread over STATS_SLOTS cache-aligned slots, a client
+ * thread picks one by hashing pid and thread ID, and updated with
+ * atomic adds: no lock, and few threads share a cache line. The server
+ * sums the slots every LOG_INTERVAL: requests - grants is the current
+ * queue depth, the differences with the previous sum, over the time
+ * actually elapsed, give the events per second and the histograms of
+ * the interval. The peak depth since the last collection is kept in the
+ * header, so that a burst between two collections is not lost.
+ **/
+#define STATS_SHM_NAME      "/simple_scheduler_stats"
+#define STATS_MAGIC         0x53544154
+#define STATS_SLOTS         64
+#define STATS_BUCKETS       32  // bucket k: [2^k, 2^(k+1)) us, bucket 0 also < 1 us
+
+typedef struct {
+    unsigned long requests;
+    unsigned long grants;
+    unsigned long releases;
+    unsigned long long wait_ns;     // sums, for the averages
+    unsigned long long hold_ns;
+    unsigned long wait_hist[STATS_BUCKETS];
+    unsigned long hold_hist[STATS_BUCKETS];
+} __attribute__((aligned(64))) stats_slot_t;
+
+typedef struct {
+    int magic;
+    int waiting;        // clients between request and grant
+    int peak_waiting;   // max of waiting since the last statsCollect()
+    stats_slot_t slots[STATS_SLOTS];
+} stats_region_t;
+
+// sum of all the slots, as returned by statsCollect()
+typedef struct {
+    unsigned long requests;
+    unsigned long grants;
+    unsigned long releases;
+    unsigned long long wait_ns;
+    unsigned long long hold_ns;
+    unsigned long wait_hist[STATS_BUCKETS];
+    unsigned long hold_hist[STATS_BUCKETS];
+    int peak_waiting;
+} stats_totals_t;
+
+// server: creates (replacing a stale one) and removes the segment
+stats_region_t* statsCreate();
+void statsDestroy(stats_region_t* stats);
+
+// clients: map the segment created by the server
+stats_region_t* statsOpen();
+void statsClose(stats_region_t* stats);
+
+// CLOCK_MONOTONIC in nanoseconds
+unsigned long long statsNow();
+
+int statsSlot(int threadID);
+void statsRequest(stats_region_t* stats, int slot);
+void statsGranted(stats_region_t* stats, int slot, unsigned long long wait_ns);
+void statsReleased(stats_region_t* stats, int slot, unsigned long long hold_ns);
+
+// sums the slots and resets the peak queue depth
+void statsCollect(stats_region_t* stats, stats_totals_t* totals);
+
+// events between two collections, from which the interval percentiles
+void statsInterval(const stats_totals_t* totals, const stats_totals_t* previous, stats_totals_t* interval);
+
+// upper bound in microseconds of the bucket holding the given percentile
+unsigned long statsPercentile(const unsigned long* hist, double percentile);
+
+#endif
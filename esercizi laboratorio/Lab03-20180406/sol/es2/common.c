@@ -1,19 +1,27 @@
+#define _GNU_SOURCE // fallocate()
 #include "common.h"
 
+#include <fcntl.h>
+#include <stdint.h>   // SIZE_MAX
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// reserves the blocks of a zero-filled file of size bytes in one call
+static void preallocateFile(int fd, off_t size, const char* msg) {
+    if (fallocate(fd, 0, 0, size) == 0) return;
+    // not supported by the file system: a sparse file is zero-filled too
+    if (errno != EOPNOTSUPP || ftruncate(fd, size)) handle_error(msg);
+}
+
 void initFile(int numElems, char* fileName) {
     // I will create a zero-filled file of (2+numElems)*sizeof(int) bytes
     // where the last 8 bytes are used for storing read & write indexes
-    FILE* fp = fopen(fileName, "wb");
-    if (fp == NULL) handle_error("initFile fopen");
-
-    int i, ret, value=0;
-    for (i=0; i<numElems+2; ++i) {
-        ret = fwrite(&value, sizeof(int), 1, fp);
-        if (ret != 1) handle_error("initFile fwrite");
-    }    
-
-    ret = fclose(fp);
-    if (ret == EOF) handle_error("initFile fclose");
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) handle_error("initFile open");
+    preallocateFile(fd, bufferFileSize(numElems, MODE_FILE), "initFile fallocate");
+    if (close(fd)) handle_error("initFile close");
 }
 
 void writeToBufferFile(int value, int numElems, char* fileName) {
@@ -22,22 +30,22 @@ void writeToBufferFile(int value, int numElems, char* fileName) {
     if (fp == NULL) handle_error("writeToBufferFile fopen");
 
     // write_index is after (numElems+1)*sizeof(int) bytes
-    int windex_offset = (numElems+1)*sizeof(int);
-    ret = fseek(fp, windex_offset, SEEK_SET);
+    off_t windex_offset = (off_t)(numElems+1)*sizeof(int);
+    ret = fseeko(fp, windex_offset, SEEK_SET);
     if (ret) handle_error("writeToBufferFile fseek index");
     ret = fread(&write_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("writeToBufferFile fread index");
 
     // write element to file
-    int element_offset = write_index*sizeof(int);
-    ret = fseek(fp, element_offset, SEEK_SET);
+    off_t element_offset = (off_t)write_index*sizeof(int);
+    ret = fseeko(fp, element_offset, SEEK_SET);
     if (ret) handle_error("writeToBufferFile fseek element") ;
     ret = fwrite(&value, sizeof(int), 1, fp);
     if (ret != 1) handle_error("writeToBufferFile fwrite element");
 
     // update write_index
     write_index = (write_index + 1) % numElems;
-    ret = fseek(fp, windex_offset, SEEK_SET);
+    ret = fseeko(fp, windex_offset, SEEK_SET);
     if (ret) handle_error("writeToBufferFile fseek index");
     ret = fwrite(&write_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("writeToBufferFile fwrite index"); 
@@ -52,22 +60,22 @@ int readFromBufferFile(int numElems, char* fileName) {
     if (fp == NULL) handle_error("readFromBufferFile fopen");
 
     // read_index is after numElems*sizeof(int) bytes
-    int rindex_offset = numElems*sizeof(int);
-    ret = fseek(fp, rindex_offset, SEEK_SET);
+    off_t rindex_offset = (off_t)numElems*sizeof(int);
+    ret = fseeko(fp, rindex_offset, SEEK_SET);
     if (ret) handle_error("readFromBufferFile fseek index");
     ret = fread(&read_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("readFromBufferFile fread index");
 
     // read element from file
-    int element_offset = read_index*sizeof(int);
-    ret = fseek(fp, element_offset, SEEK_SET);
+    off_t element_offset = (off_t)read_index*sizeof(int);
+    ret = fseeko(fp, element_offset, SEEK_SET);
     if (ret) handle_error("readFromBufferFile fseek element");
     ret = fread(&value, sizeof(int), 1, fp);
     if (ret != 1) handle_error("readFromBufferFile fread element");
 
     // update read_index
     read_index = (read_index + 1) % numElems;
-    ret = fseek(fp, rindex_offset, SEEK_SET);
+    ret = fseeko(fp, rindex_offset, SEEK_SET);
     if (ret) handle_error("readFromBufferFile fseek index");
     ret = fwrite(&read_index, sizeof(int), 1, fp);
     if (ret != 1) handle_error("readFromBufferFile fwrite index");
@@ -76,4 +84,310 @@ int readFromBufferFile(int numElems, char* fileName) {
     if (ret == EOF) handle_error("readFromBufferFile fclose");
 
     return value;
-}
\ No newline at end of file
+}
+
+size_t bufferFileSize(int numElems, int mode) {
+    return HAS_SHARED_SYNC(mode) ? SHARED_FILE_SIZE(numElems) : ((size_t)numElems+2)*sizeof(int);
+}
+
+void mapBufferFile(mapped_buffer_t* buffer, int numElems, char* fileName, int mode, int hugePages) {
+    buffer->fd = open(fileName, O_RDWR);
+    if (buffer->fd == -1) handle_error("mapBufferFile open");
+
+    // the file must be the one built by initFile() (and initSharedSync())
+    // with the same number of slots, or the indexes would be elsewhere
+    struct stat st;
+    buffer->size = bufferFileSize(numElems, mode);
+    if (fstat(buffer->fd, &st)) handle_error("mapBufferFile fstat");
+    if ((size_t)st.st_size != buffer->size) handle_error_en(EINVAL, "mapBufferFile size (check -s and -m)");
+
+    void* addr = mmap(NULL, buffer->size, PROT_READ | PROT_WRITE, MAP_SHARED, buffer->fd, 0);
+    if (addr == MAP_FAILED) handle_error("mapBufferFile mmap");
+    // only a hint: no huge pages is slower, not wrong
+    if (hugePages && madvise(addr, buffer->size, MADV_HUGEPAGE))
+        perror("mapBufferFile madvise(MADV_HUGEPAGE)");
+
+    buffer->numElems = numElems;
+    buffer->elems = (int*)addr;
+    buffer->read_index = buffer->elems + numElems;
+    buffer->write_index = buffer->elems + numElems + 1;
+    buffer->sync = NULL;
+    buffer->meta = NULL;
+    if (HAS_SHARED_SYNC(mode)) {
+        buffer->sync = (shared_sync_t*)((char*)addr + SYNC_OFFSET(numElems));
+        buffer->meta = (slot_meta_t*)((char*)addr + META_OFFSET(numElems));
+        if (buffer->sync->magic != SYNC_MAGIC) handle_error_en(EINVAL, "mapBufferFile sync header");
+    }
+}
+
+void unmapBufferFile(mapped_buffer_t* buffer) {
+    if (munmap(buffer->elems, buffer->size)) handle_error("unmapBufferFile munmap");
+    if (close(buffer->fd)) handle_error("unmapBufferFile close");
+}
+
+void writeToMappedBuffer(mapped_buffer_t* buffer, int value) {
+    int write_index = *buffer->write_index;
+    buffer->elems[write_index] = value;
+    *buffer->write_index = (write_index + 1) % buffer->numElems;
+}
+
+int readFromMappedBuffer(mapped_buffer_t* buffer) {
+    int read_index = *buffer->read_index;
+    int value = buffer->elems[read_index];
+    *buffer->read_index = (read_index + 1) % buffer->numElems;
+    return value;
+}
+
+// (re)initializes mutex and condition variables, nobody must be using them
+static void initSyncObjects(shared_sync_t* sync) {
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
+    int ret = pthread_mutex_init(&sync->lock, &mattr);
+    if (ret) handle_error_en(ret, "initSharedSync pthread_mutex_init");
+    pthread_mutexattr_destroy(&mattr);
+
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    ret = pthread_cond_init(&sync->not_empty, &cattr);
+    if (ret) handle_error_en(ret, "initSharedSync pthread_cond_init");
+    ret = pthread_cond_init(&sync->not_full, &cattr);
+    if (ret) handle_error_en(ret, "initSharedSync pthread_cond_init");
+    pthread_condattr_destroy(&cattr);
+}
+
+void initSharedSync(int numElems, char* fileName) {
+    int fd = open(fileName, O_RDWR);
+    if (fd == -1) handle_error("initSharedSync open");
+    // the file has just been truncated by initFile(): the metadata is zeroed
+    size_t size = SHARED_FILE_SIZE(numElems);
+    preallocateFile(fd, size, "initSharedSync fallocate");
+
+    char* addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) handle_error("initSharedSync mmap");
+    shared_sync_t* sync = (shared_sync_t*)(addr + SYNC_OFFSET(numElems));
+
+    initSyncObjects(sync);
+    sync->count = 0;
+    sync->read_seq = sync->write_seq = 0;
+    sync->numGroups = 0;
+    memset(sync->groups, 0, sizeof(sync->groups));
+    sync->magic = SYNC_MAGIC;
+
+    if (munmap(addr, size)) handle_error("initSharedSync munmap");
+    if (close(fd)) handle_error("initSharedSync close");
+}
+
+// CRC-32 (IEEE 802.3) of value followed by seq
+unsigned int slotChecksum(int value, unsigned int seq) {
+    static unsigned int table[256];
+    static int ready = 0;
+    unsigned int i, j, crc;
+    if (!ready) { // the same table in every process, no need to synchronize
+        for (i = 0; i < 256; ++i) {
+            for (crc = i, j = 0; j < 8; ++j)
+                crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : crc >> 1;
+            table[i] = crc;
+        }
+        ready = 1;
+    }
+    unsigned char bytes[8];
+    memcpy(bytes, &value, 4);
+    memcpy(bytes+4, &seq, 4);
+    crc = 0xFFFFFFFF;
+    for (i = 0; i < 8; ++i)
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static int slotValid(mapped_buffer_t* buffer, unsigned long long seq) {
+    int slot = (seq-1) % buffer->numElems;
+    slot_meta_t* meta = &buffer->meta[slot];
+    return meta->seq == (unsigned int)seq && meta->crc == slotChecksum(buffer->elems[slot], meta->seq);
+}
+
+/*
+ * To be run when no other process uses the buffer, e.g. by a producer
+ * restarting after a crash. Returns the number of items still queued.
+ */
+int recoverSharedBuffer(int numElems, char* fileName) {
+    mapped_buffer_t buffer;
+    mapBufferFile(&buffer, numElems, fileName, MODE_MUTEX, 0);
+    shared_sync_t* sync = buffer.sync;
+
+    // the items after read_seq are queued as long as their slots are valid
+    unsigned long long seq = sync->read_seq;
+    while (seq < sync->read_seq + numElems && slotValid(&buffer, seq+1))
+        ++seq;
+    sync->write_seq = seq;
+    sync->count = (int)(sync->write_seq - sync->read_seq);
+    *buffer.read_index = sync->read_seq % numElems;
+    *buffer.write_index = sync->write_seq % numElems;
+    // MODE_LOG: no group can be past a lost item
+    int i;
+    for (i = 0; i < sync->numGroups; ++i)
+        if (sync->groups[i].offset > sync->write_seq) sync->groups[i].offset = sync->write_seq;
+
+    // a dead process may have left them locked or with waiters
+    initSyncObjects(sync);
+
+    int count = sync->count;
+    unmapBufferFile(&buffer);
+    return count;
+}
+
+/*
+ * A process died holding the mutex, maybe between the stores that end
+ * an operation. write_seq only moves once the items are in place, and
+ * the sequence numbers are the only fields that matter: count and the
+ * indexes are derived from them, so they are rebuilt before the mutex
+ * is marked consistent. In MODE_LOG read_seq may lag the slowest group
+ * for a while, its slots are reclaimed by the next take.
+ */
+static void checkLock(mapped_buffer_t* buffer, int ret, const char* msg) {
+    shared_sync_t* sync = buffer->sync;
+    if (ret == EOWNERDEAD) {
+        sync->count = (int)(sync->write_seq - sync->read_seq);
+        *buffer->read_index = sync->read_seq % buffer->numElems;
+        *buffer->write_index = sync->write_seq % buffer->numElems;
+        ret = pthread_mutex_consistent(&sync->lock);
+    }
+    if (ret) handle_error_en(ret, msg);
+}
+
+int putToSharedBuffer(mapped_buffer_t* buffer, const int* values, int count) {
+    shared_sync_t* sync = buffer->sync;
+    checkLock(buffer, pthread_mutex_lock(&sync->lock), "putToSharedBuffer lock");
+    while (sync->count == buffer->numElems)
+        checkLock(buffer, pthread_cond_wait(&sync->not_full, &sync->lock), "putToSharedBuffer wait");
+
+    // as many slots as we have values and the buffer has room for
+    int i, n = buffer->numElems - sync->count, write_index = *buffer->write_index;
+    if (n > count) n = count;
+    for (i = 0; i < n; ++i) {
+        // value, then CRC, then seq: a valid seq means a complete slot
+        unsigned int seq = (unsigned int)(sync->write_seq + i + 1);
+        buffer->elems[write_index] = values[i];
+        buffer->meta[write_index].crc = slotChecksum(values[i], seq);
+        __atomic_store_n(&buffer->meta[write_index].seq, seq, __ATOMIC_RELEASE);
+        write_index = (write_index + 1) % buffer->numElems;
+    }
+    // publication: only now the items become visible to the consumers
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    sync->write_seq += n;
+    *buffer->write_index = write_index;
+    sync->count += n;
+
+    // in MODE_LOG every group must see the items
+    if (n == 1 && sync->numGroups == 0) pthread_cond_signal(&sync->not_empty);
+    else pthread_cond_broadcast(&sync->not_empty);
+    pthread_mutex_unlock(&sync->lock);
+    return n;
+}
+
+int takeFromSharedBuffer(mapped_buffer_t* buffer, int* values, int count) {
+    shared_sync_t* sync = buffer->sync;
+    checkLock(buffer, pthread_mutex_lock(&sync->lock), "takeFromSharedBuffer lock");
+    while (sync->count == 0)
+        checkLock(buffer, pthread_cond_wait(&sync->not_empty, &sync->lock), "takeFromSharedBuffer wait");
+
+    int i, n = sync->count, read_index = *buffer->read_index;
+    if (n > count) n = count;
+    for (i = 0; i < n; ++i) {
+        values[i] = buffer->elems[read_index];
+        read_index = (read_index + 1) % buffer->numElems;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    sync->read_seq += n;
+    *buffer->read_index = read_index;
+    sync->count -= n;
+
+    if (n == 1) pthread_cond_signal(&sync->not_full);
+    else pthread_cond_broadcast(&sync->not_full);
+    pthread_mutex_unlock(&sync->lock);
+    return n;
+}
+
+/*
+ * Returns the index of the group in the header, creating the group if
+ * needed. Groups are never removed: a group nobody reads any more
+ * eventually blocks the producers, as a group falling behind does.
+ */
+int joinConsumerGroup(mapped_buffer_t* buffer, const char* name) {
+    shared_sync_t* sync = buffer->sync;
+    if (name[0] == '\0' || strlen(name) >= GROUP_NAME_LEN) handle_error_en(ENAMETOOLONG, "joinConsumerGroup name");
+    checkLock(buffer, pthread_mutex_lock(&sync->lock), "joinConsumerGroup lock");
+    int group;
+    for (group = 0; group < sync->numGroups; ++group)
+        if (strcmp(sync->groups[group].name, name) == 0) break;
+    if (group == sync->numGroups) {
+        if (group == MAX_GROUPS) handle_error_en(ENOSPC, "joinConsumerGroup");
+        strcpy(sync->groups[group].name, name);
+        sync->groups[group].offset = sync->read_seq;   // the oldest item kept
+        sync->numGroups++;
+    }
+    pthread_mutex_unlock(&sync->lock);
+    return group;
+}
+
+int takeFromConsumerGroup(mapped_buffer_t* buffer, int group, int* values, int count) {
+    shared_sync_t* sync = buffer->sync;
+    consumer_group_t* g = &sync->groups[group];
+    checkLock(buffer, pthread_mutex_lock(&sync->lock), "takeFromConsumerGroup lock");
+    while (g->offset == sync->write_seq)
+        checkLock(buffer, pthread_cond_wait(&sync->not_empty, &sync->lock), "takeFromConsumerGroup wait");
+
+    // the items of the group start at its own offset, not at read_index
+    int i, n = (int)(sync->write_seq - g->offset);
+    if (n > count) n = count;
+    for (i = 0; i < n; ++i)
+        values[i] = buffer->elems[(g->offset + i) % buffer->numElems];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    g->offset += n;
+
+    // slots are reclaimed when the slowest group moves on
+    unsigned long long low = g->offset;
+    for (i = 0; i < sync->numGroups; ++i)
+        if (sync->groups[i].offset < low) low = sync->groups[i].offset;
+    if (low > sync->read_seq) {
+        sync->count -= (int)(low - sync->read_seq);
+        sync->read_seq = low;
+        *buffer->read_index = low % buffer->numElems;
+        pthread_cond_broadcast(&sync->not_full);
+    }
+    pthread_mutex_unlock(&sync->lock);
+    return n;
+}
+
+int parseMode(const char* name) {
+    if (strcmp(name, "file") == 0) return MODE_FILE;
+    if (strcmp(name, "mmap") == 0) return MODE_MMAP;
+    if (strcmp(name, "mutex") == 0) return MODE_MUTEX;
+    if (strcmp(name, "log") == 0) return MODE_LOG;
+    return -1;
+}
+
+// number of slots, with an optional k, M or G (powers of 1024) suffix
+int parseCapacity(const char* arg) {
+    char* end;
+    int shift = 0;
+    long long n = strtoll(arg, &end, 10);
+    if (*end == 'k' || *end == 'K') shift = 10;
+    else if (*end == 'M') shift = 20;
+    else if (*end == 'G') shift = 30;
+    if (shift) ++end;
+    if (*end != '\0' || n < 1 || n > (MAX_BUFFER_SIZE >> shift)) return -1;
+    n <<= shift;
+    // the largest file, MODE_MUTEX, must leave room in the address space
+    // (the header is well below a page)
+    if ((unsigned long long)n*(sizeof(int) + sizeof(slot_meta_t)) + 4096 > SIZE_MAX/2) return -1;
+    return (int)n;
+}
+
+double elapsedSeconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -1,6 +1,8 @@
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 // macros for handling errors
 #define handle_error_en(en, msg) \
@@ -9,8 +11,9 @@
     do { perror(msg); exit(EXIT_FAILURE); } while (0)
 
 // macros for producer.c and consumer.c
-#define BUFFER_SIZE         128
-#define BUFFER_FILENAME     "bufferfile.bin"
+#define BUFFER_SIZE         128 // default slots, -s of producer and consumer
+#define BUFFER_FILENAME     "bufferfile.bin"    // default file, -f
+#define MAX_BUFFER_SIZE     (1 << 30)
 #define INITIAL_DEPOSIT     0
 #define MAX_TRANSACTION     1000
 #define NUM_CONSUMERS       2
@@ -29,8 +32,139 @@
 #define SEMNAME_EMPTY       "/mysemempty"
 #define SEMNAME_CS          "/mysemcs"
 
+// buffer access modes (-m option of producer and consumer)
+#define MODE_FILE           0
+#define MODE_MMAP           1
+#define MODE_MUTEX          2
+#define MODE_LOG            3
+#define HAS_SHARED_SYNC(m)  ((m) >= MODE_MUTEX)   // synchronization in the file
+
+#define BATCH_SIZE          16  // default slots per lock acquisition in MODE_MUTEX
+
+/*
+ * The buffer file mapped with mmap(MAP_SHARED): the same layout written
+ * by initFile(), i.e. numElems ints followed by read_index and
+ * write_index, so the two modes can even be mixed. Items are read and
+ * written with plain loads and stores instead of a dozen system calls
+ * and a FILE allocation per item. With -m mmap the semaphores still
+ * provide the mutual exclusion (and the memory barriers); with -m mutex
+ * and -m log sync and meta point into the file, see shared_sync below.
+ */
+typedef struct shared_sync shared_sync_t;
+typedef struct slot_meta slot_meta_t;
+typedef struct consumer_group consumer_group_t;
+
+typedef struct {
+    int fd;
+    int numElems;
+    size_t size;
+    int* elems;
+    int* read_index;
+    int* write_index;
+    shared_sync_t* sync;    // MODE_MUTEX and MODE_LOG only
+    slot_meta_t* meta;      // MODE_MUTEX and MODE_LOG only
+} mapped_buffer_t;
+
+/*
+ * The capacity is chosen at run time with -s (the same for producer and
+ * consumer, mapBufferFile() checks it against the file size), up to
+ * millions of slots. The file is preallocated with a single fallocate()
+ * (a sparse ftruncate() where not supported) instead of writing the
+ * zeros. With -H the mapping is advised for transparent huge pages,
+ * which saves TLB misses on large buffers: the kernel honours it for
+ * files on tmpfs (e.g. -f /dev/shm/bufferfile.bin) when
+ * /sys/kernel/mm/transparent_hugepage/shmem_enabled allows it.
+ * MAP_HUGETLB is not an option here, it only applies to anonymous or
+ * hugetlbfs mappings. Capacities whose file does not fit in the
+ * address space (half of it, actually) are refused by parseCapacity():
+ * multi-GB buffers need a 64-bit build, i.e. make CFLAGS="-g -Wall".
+ */
+
+/*
+ * MODE_MUTEX keeps the synchronization in the file too, instead of the
+ * three named semaphores: a robust process-shared mutex and two
+ * process-shared condition variables live in a header after the
+ * indexes (at SYNC_OFFSET, so the slots and the indexes stay where
+ * initFile() puts them). Nothing survives in /dev/shm after a crash,
+ * and a process dying while holding the mutex does not block the
+ * others forever: the next locker gets EOWNERDEAD and takes over.
+ * Producers and consumers move up to k items per lock acquisition.
+ */
+#define SYNC_MAGIC          0x53594E43
+#define SYNC_OFFSET(n)      ((((n)+2)*sizeof(int) + 63) & ~(size_t)63)
+
+/*
+ * MODE_LOG turns the buffer into an append-only log read by named
+ * consumer groups (-g of the consumer): every group gets every item,
+ * the consumers of a group share its items. Each group keeps its
+ * committed offset, the number of items it has taken, in the header;
+ * read_seq becomes the smallest offset, so a slot is reclaimed (and a
+ * producer waiting for room woken up) only when all the groups have
+ * passed it. A group that does not exist yet starts from the oldest
+ * item still in the buffer: the producer creates with -G the groups
+ * that must not lose any item. Same mutex, conditions and slot
+ * metadata as MODE_MUTEX, so recovery works the same way.
+ */
+#define MAX_GROUPS          8
+#define GROUP_NAME_LEN      32
+
+struct consumer_group {
+    char name[GROUP_NAME_LEN];      // empty for a free entry
+    unsigned long long offset;      // items taken by the group
+};
+
+struct shared_sync {
+    int magic;              // SYNC_MAGIC once initialized
+    int count;              // items in the buffer
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    unsigned long long read_seq;    // items consumed since initSharedSync()
+    unsigned long long write_seq;   // items published since initSharedSync()
+    int numGroups;                  // MODE_LOG
+    consumer_group_t groups[MAX_GROUPS];
+};
+
+/*
+ * Crash consistency in MODE_MUTEX: item number seq (1, 2, ...) goes to
+ * slot (seq-1) % numElems and the slot gets a metadata entry, kept in a
+ * separate array at META_OFFSET so the int slots do not move, with seq
+ * and a CRC-32 of value and seq. A producer writes the value, then the
+ * CRC, then seq, and only then advances write_seq and write_index; a
+ * consumer advances read_seq and read_index after taking its items.
+ * recoverSharedBuffer() can thus rebuild the positions after a process
+ * died at any point: the queued items are those following read_seq
+ * whose slots carry the expected seq and a matching CRC. An item read
+ * by a consumer that died before advancing read_seq is delivered again.
+ */
+struct slot_meta {
+    unsigned int seq;       // low 32 bits of the item number, 0 never written
+    unsigned int crc;
+};
+
+#define META_OFFSET(n)      (SYNC_OFFSET(n) + ((sizeof(shared_sync_t) + 63) & ~(size_t)63))
+#define SHARED_FILE_SIZE(n) (META_OFFSET(n) + (n)*sizeof(slot_meta_t))
+
 
 // methods defined in common.c
 void initFile(int numElems, char* fileName);
 void writeToBufferFile(int value, int numElems, char* fileName);
-int readFromBufferFile(int numElems, char* fileName);
\ No newline at end of file
+int readFromBufferFile(int numElems, char* fileName);
+
+size_t bufferFileSize(int numElems, int mode);
+void mapBufferFile(mapped_buffer_t* buffer, int numElems, char* fileName, int mode, int hugePages);
+void unmapBufferFile(mapped_buffer_t* buffer);
+void writeToMappedBuffer(mapped_buffer_t* buffer, int value);
+int readFromMappedBuffer(mapped_buffer_t* buffer);
+
+void initSharedSync(int numElems, char* fileName);
+int putToSharedBuffer(mapped_buffer_t* buffer, const int* values, int count);
+int takeFromSharedBuffer(mapped_buffer_t* buffer, int* values, int count);
+int recoverSharedBuffer(int numElems, char* fileName);
+int joinConsumerGroup(mapped_buffer_t* buffer, const char* name);
+int takeFromConsumerGroup(mapped_buffer_t* buffer, int group, int* values, int count);
+unsigned int slotChecksum(int value, unsigned int seq);
+
+int parseMode(const char* name);
+int parseCapacity(const char* arg);
+double elapsedSeconds(struct timespec* start);
\ No newline at end of file
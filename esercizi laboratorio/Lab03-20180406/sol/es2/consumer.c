@@ -4,10 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 sem_t *sem_filled, *sem_empty, *sem_cs;
 
+int mode = MODE_FILE;
+int batch = BATCH_SIZE; // MODE_MUTEX and MODE_LOG
+int group = -1; // MODE_LOG, index in the file header
+int numElems = BUFFER_SIZE;
+char* fileName = BUFFER_FILENAME;
+mapped_buffer_t buffer; // all modes but MODE_FILE, mapped before forking the consumers
+
 void openSemaphores() {
     sem_filled = sem_open(SEMNAME_FILLED, 0);
     if (sem_filled == SEM_FAILED) handle_error("sem_open filled");
@@ -54,7 +62,8 @@ void consume(int id, int numOps) {
         if (ret) handle_error("sem_wait cs");
 
         // producer, just do your thing!
-        int value = readFromBufferFile(BUFFER_SIZE, BUFFER_FILENAME);
+        int value = (mode == MODE_MMAP) ? readFromMappedBuffer(&buffer)
+                                        : readFromBufferFile(numElems, fileName);
         localSum += value;
 
         sem_post(sem_cs);
@@ -68,34 +77,98 @@ void consume(int id, int numOps) {
     printf("Consumer %d ended. Local sum is %d\n", id, localSum);
 }
 
+// MODE_MUTEX and MODE_LOG: up to batch items per acquisition of the in-file mutex
+void consumeShared(int id, int numOps) {
+    int localSum = 0;
+    int* values = malloc(batch*sizeof(int));
+    if (values == NULL) handle_error("malloc");
+    while (numOps > 0) {
+        int want = (numOps < batch) ? numOps : batch;
+        int i, n = (mode == MODE_LOG) ? takeFromConsumerGroup(&buffer, group, values, want)
+                                      : takeFromSharedBuffer(&buffer, values, want);
+        for (i=0; i<n; ++i)
+            localSum += values[i];
+        numOps -= n;
+    }
+    free(values);
+    printf("Consumer %d ended. Local sum is %d\n", id, localSum);
+}
+
 int main(int argc, char** argv) {
-    if (access(BUFFER_FILENAME, F_OK) == -1) {
+    // -m file|mmap|mutex|log selects how the buffer file is accessed, -n
+    // must match the total operations of the producer, -c sets the number of
+    // consumer processes and -k the batch size in mutex and log modes; -s and
+    // -f must match the slots and the file of the producer, -H asks for huge
+    // pages; -g (log mode) names the consumer group, whose consumers share
+    // its items
+    int opt, numOps = NUM_OPERATIONS, numConsumers = NUM_CONSUMERS, hugePages = 0;
+    char* groupName = NULL;
+    while ((opt = getopt(argc, argv, "m:n:c:k:s:f:Hg:")) != -1) {
+        if (opt == 'm' && (mode = parseMode(optarg)) != -1) continue;
+        else if (opt == 'n' && (numOps = atoi(optarg)) > 0) continue;
+        else if (opt == 'c' && (numConsumers = atoi(optarg)) > 0) continue;
+        else if (opt == 'k' && (batch = atoi(optarg)) > 0) continue;
+        else if (opt == 's' && (numElems = parseCapacity(optarg)) != -1) continue;
+        else if (opt == 'f') fileName = optarg;
+        else if (opt == 'H') hugePages = 1;
+        else if (opt == 'g') groupName = optarg;
+        else {
+            fprintf(stderr, "Syntax: %s [-m file|mmap|mutex|log] [-n <operations>] [-c <consumers>] "
+                    "[-k <batch>] [-s <slots>[k|M|G]] [-f <file>] [-H] [-g <group>]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((mode == MODE_LOG) != (groupName != NULL)) {
+        fprintf(stderr, "-m log needs a consumer group (-g) and vice versa\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (access(fileName, F_OK) == -1) {
         printf("ERROR: no buffer file. Start the producer(s) first!\n");
         exit(EXIT_FAILURE);
     }
+    // mapBufferFile() checks the size in the other modes
+    struct stat st;
+    if (mode == MODE_FILE && (stat(fileName, &st) || (size_t)st.st_size != bufferFileSize(numElems, mode))) {
+        printf("ERROR: the buffer file does not have %d slots (check -s)\n", numElems);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!HAS_SHARED_SYNC(mode)) openSemaphores();
+    if (mode != MODE_FILE) mapBufferFile(&buffer, numElems, fileName, mode, hugePages);
+    if (mode == MODE_LOG) group = joinConsumerGroup(&buffer, groupName);
 
-    openSemaphores();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     int i;
-    for (i=0; i<NUM_CONSUMERS; ++i) {
+    for (i=0; i<numConsumers; ++i) {
         pid_t pid = fork();
         if (pid == -1) {
             handle_error("fork");
         } else if (pid == 0) {
-            consume(i, OPS_PER_CONSUMER);
+            // operations split as evenly as possible, the first get the remainder
+            int ops = numOps/numConsumers + (i < numOps%numConsumers);
+            if (HAS_SHARED_SYNC(mode))
+                consumeShared(i, ops);
+            else
+                consume(i, ops);
             _exit(EXIT_SUCCESS);
         }
     }
 
-    for (i=0; i<NUM_CONSUMERS; ++i) {
+    for (i=0; i<numConsumers; ++i) {
         int status;
         wait(&status);
         if (WEXITSTATUS(status)) handle_error("child crashed");
     }
 
-    printf("Consumers have terminated. Exiting...\n");
+    double seconds = elapsedSeconds(&start);
+    printf("Consumers have terminated: %d items in %.3f s (%.0f items/s). Exiting...\n",
+            numOps, seconds, numOps / seconds);
+    if (mode != MODE_FILE) unmapBufferFile(&buffer);
 
-    closeAndDestroySemaphores();
+    if (!HAS_SHARED_SYNC(mode)) closeAndDestroySemaphores();
 
     exit(EXIT_SUCCESS);
 }
\ No newline at end of file
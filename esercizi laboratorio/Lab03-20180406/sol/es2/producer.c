@@ -4,12 +4,20 @@
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/wait.h>
 
 sem_t *sem_filled, *sem_empty, *sem_cs;
 
+int mode = MODE_FILE;
+int benchmark = 0; // no artificial delay when producing
+int batch = BATCH_SIZE; // MODE_MUTEX and MODE_LOG
+int numElems = BUFFER_SIZE;
+char* fileName = BUFFER_FILENAME;
+mapped_buffer_t buffer; // all modes but MODE_FILE, mapped before forking the producers
+
 void initSemaphores() {
     // delete stale semaphores from a previous crash (if any)
     sem_unlink(SEMNAME_FILLED);
@@ -19,7 +27,7 @@ void initSemaphores() {
     sem_filled = sem_open(SEMNAME_FILLED, O_CREAT | O_EXCL, 0600, 0);
     if (sem_filled == SEM_FAILED) handle_error("sem_open filled");
 
-    sem_empty = sem_open(SEMNAME_EMPTY, O_CREAT | O_EXCL, 0600, BUFFER_SIZE);
+    sem_empty = sem_open(SEMNAME_EMPTY, O_CREAT | O_EXCL, 0600, numElems);
     if (sem_empty == SEM_FAILED) handle_error("sem_open empty");
 
     sem_cs = sem_open(SEMNAME_CS, O_CREAT | O_EXCL, 0600, 1);
@@ -38,9 +46,11 @@ void closeSemaphores() {
 }
 
 static inline int performRandomTransaction() {
-    struct timespec pause = {0};
-    pause.tv_nsec = 10000000; // 10 ms (10*10^6 ns)
-    nanosleep(&pause, NULL);
+    if (!benchmark) {
+        struct timespec pause = {0};
+        pause.tv_nsec = 10000000; // 10 ms (10*10^6 ns)
+        nanosleep(&pause, NULL);
+    }
 
     int amount = rand() % (2 * MAX_TRANSACTION);
     return (amount >= MAX_TRANSACTION) ? (MAX_TRANSACTION-amount-1) : (amount+1);
@@ -57,7 +67,10 @@ void produce(int id, int numOps) {
 
         // producer, just do your thing!
         int value = performRandomTransaction();
-        writeToBufferFile(value, BUFFER_SIZE, BUFFER_FILENAME);
+        if (mode == MODE_MMAP)
+            writeToMappedBuffer(&buffer, value);
+        else
+            writeToBufferFile(value, numElems, fileName);
         localSum += value;
 
         sem_post(sem_cs);
@@ -71,31 +84,113 @@ void produce(int id, int numOps) {
     printf("Producer %d ended. Local sum is %d\n", id, localSum);
 }
 
+// MODE_MUTEX and MODE_LOG: up to batch items per acquisition of the in-file mutex
+void produceShared(int id, int numOps) {
+    int localSum = 0;
+    int* values = malloc(batch*sizeof(int));
+    if (values == NULL) handle_error("malloc");
+    while (numOps > 0) {
+        int i, n = (numOps < batch) ? numOps : batch;
+        for (i=0; i<n; ++i) {
+            values[i] = performRandomTransaction();
+            localSum += values[i];
+        }
+        // the buffer may have room for fewer items than we have
+        for (i=0; i<n; )
+            i += putToSharedBuffer(&buffer, values+i, n-i);
+        numOps -= n;
+    }
+    free(values);
+    printf("Producer %d ended. Local sum is %d\n", id, localSum);
+}
+
 int main(int argc, char** argv) {
+    // -m file|mmap|mutex|log selects how the buffer file is accessed, -b
+    // removes the delay of performRandomTransaction(), -n changes the total
+    // operations, -p the number of producer processes and -k the batch size
+    // in mutex and log modes; -r (mutex and log modes) recovers the queued
+    // items instead of reinitializing; -s sets the number of slots, -f the
+    // buffer file and -H asks for huge pages; -G (log mode) creates the
+    // comma-separated consumer groups before producing
+    int opt, numOps = NUM_OPERATIONS, numProducers = NUM_PRODUCERS, recover = 0, hugePages = 0;
+    char* groups = NULL;
+    while ((opt = getopt(argc, argv, "m:bn:p:k:rs:f:HG:")) != -1) {
+        if (opt == 'm' && (mode = parseMode(optarg)) != -1) continue;
+        else if (opt == 'b') benchmark = 1;
+        else if (opt == 'n' && (numOps = atoi(optarg)) > 0) continue;
+        else if (opt == 'p' && (numProducers = atoi(optarg)) > 0) continue;
+        else if (opt == 'k' && (batch = atoi(optarg)) > 0) continue;
+        else if (opt == 'r') recover = 1;
+        else if (opt == 's' && (numElems = parseCapacity(optarg)) != -1) continue;
+        else if (opt == 'f') fileName = optarg;
+        else if (opt == 'H') hugePages = 1;
+        else if (opt == 'G') groups = optarg;
+        else {
+            fprintf(stderr, "Syntax: %s [-m file|mmap|mutex|log] [-b] [-n <operations>] [-p <producers>] "
+                    "[-k <batch>] [-r] [-s <slots>[k|M|G]] [-f <file>] [-H] [-G <group>[,<group>...]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (recover && (!HAS_SHARED_SYNC(mode) || access(fileName, F_OK) == -1)) {
+        fprintf(stderr, "Recovery needs an existing buffer file and -m mutex or -m log\n");
+        exit(EXIT_FAILURE);
+    }
+    if (groups != NULL && mode != MODE_LOG) {
+        fprintf(stderr, "Consumer groups need -m log\n");
+        exit(EXIT_FAILURE);
+    }
+
     srand(PRNG_SEED);
-    initFile(BUFFER_SIZE, BUFFER_FILENAME);
-    initSemaphores();
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (recover) {
+        printf("Recovered %d queued items\n", recoverSharedBuffer(numElems, fileName));
+    } else {
+        initFile(numElems, fileName);
+        if (HAS_SHARED_SYNC(mode))
+            initSharedSync(numElems, fileName);
+        else
+            initSemaphores();
+    }
+    if (mode != MODE_FILE) mapBufferFile(&buffer, numElems, fileName, mode, hugePages);
+    // no item is reclaimed before these groups have read it
+    char* group;
+    if (groups != NULL)
+        for (group = strtok(groups, ","); group != NULL; group = strtok(NULL, ","))
+            joinConsumerGroup(&buffer, group);
+    printf("Buffer of %d slots (%.1f MB) ready in %.3f ms\n", numElems,
+            bufferFileSize(numElems, mode) / 1048576.0, elapsedSeconds(&start) * 1000);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     int i, ret;
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<numProducers; ++i) {
         pid_t pid = fork();
         if (pid == -1) {
             handle_error("fork");
         } else if (pid == 0) {
-            produce(i, OPS_PER_PRODUCER);
+            // operations split as evenly as possible, the first get the remainder
+            int ops = numOps/numProducers + (i < numOps%numProducers);
+            if (HAS_SHARED_SYNC(mode))
+                produceShared(i, ops);
+            else
+                produce(i, ops);
             _exit(EXIT_SUCCESS);
         }
     }
 
-    for (i=0; i<NUM_PRODUCERS; ++i) {
+    for (i=0; i<numProducers; ++i) {
         int status;
         ret = wait(&status);
         if (ret == -1) handle_error("wait");
         if (WEXITSTATUS(status)) handle_error_en(WEXITSTATUS(status), "child crashed");
     }
 
-    printf("Producers have terminated. Exiting...\n");
-    closeSemaphores();
+    double seconds = elapsedSeconds(&start);
+    printf("Producers have terminated: %d items in %.3f s (%.0f items/s). Exiting...\n",
+            numOps, seconds, numOps / seconds);
+    if (!HAS_SHARED_SYNC(mode)) closeSemaphores();
+    if (mode != MODE_FILE) unmapBufferFile(&buffer);
 
     exit(EXIT_SUCCESS);
 }
@@ -7,6 +7,8 @@
 #include <pthread.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>     // PIPE_BUF
+#include <time.h>
 
 // macros for error handling
 #include "common.h"
@@ -22,16 +24,44 @@
 
 #define FILENAME	"accesses.log"
 
+/*
+ * How records reach FILENAME (fourth command-line argument):
+ * - IO_SEMAPHORE: every thread takes the CRITICAL_SECTION semaphore and
+ *   opens, writes its record and closes the file, three system calls
+ *   per record serialized across all the processes
+ * - IO_APPEND: the threads of a child store their records in a batch of
+ *   the child, each in its own slot so no lock is needed; the child
+ *   writes the batch to the file, opened once with O_APPEND, in writes
+ *   of at most PIPE_BUF bytes. Each write is appended as a whole, so the
+ *   records of different children never mix and the semaphore is not
+ *   needed (PIPE_BUF is what POSIX promises for pipes and FIFOs; on a
+ *   regular file Linux appends every write atomically anyway)
+ * - IO_SEGMENTS: same batches, but every child writes them (SEGMENT_BATCH
+ *   records at a time) to a segment file of its own, and the main
+ *   process concatenates the segments into FILENAME at the end
+ */
+#define IO_SEMAPHORE	0
+#define IO_APPEND		1
+#define IO_SEGMENTS		2
+
+#define SEGMENT_BATCH	16384
+#define SEGMENT_NAME	FILENAME ".%d"
+
 /*
  * data structure required by threads
  */
 typedef struct thread_args_s {
     unsigned int child_id;
     unsigned int thread_id;
+    int slot;   // IO_APPEND and IO_SEGMENTS: where to store the record in batch
 } thread_args_t;
 
 // parameters can be set also via command-line arguments
-int n = N, m = M, t = T;
+int n = N, m = M, t = T, io_mode = IO_SEMAPHORE;
+
+// IO_APPEND and IO_SEGMENTS: records of this child not written yet
+int *batch = NULL;
+int batch_count = 0, batch_capacity = 0, log_fd = -1;
 
 /*
  * named semaphore for letting main process wait for all the children to
@@ -80,10 +110,37 @@ void init_file(const char *filename) {
     printf("closed...file correctly initialized!!!\n");
 }
 
+/*
+ * Writes the batch of the child: in IO_APPEND mode each write() carries at
+ * most PIPE_BUF bytes and must not be split, or another child could
+ * append between the two parts.
+ */
+void flush_batch(int child_id) {
+    int chunk = (io_mode == IO_APPEND) ? (int)(PIPE_BUF / sizeof(int)) : batch_count;
+    int written = 0;
+    while (written < batch_count) {
+        int count = (batch_count - written < chunk) ? batch_count - written : chunk;
+        ssize_t bytes = write(log_fd, batch + written, count * sizeof(int));
+        if (bytes < 0) handle_error("error while writing the batch");
+        if (bytes != (ssize_t)(count * sizeof(int))) handle_error_en(EIO, "short write of the batch");
+        written += count;
+    }
+    printf("[Child#%d] %d records written from the batch!!!\n", child_id, batch_count);
+    batch_count = 0;
+}
+
 void* thread_function(void* arg_ptr) {
 
     thread_args_t *args = (thread_args_t*)arg_ptr;
 
+    if (io_mode != IO_SEMAPHORE) {
+        // our own slot in the batch: no lock, no system call (the batch
+        // is reported once, when flushed)
+        batch[args->slot] = args->child_id;
+        free(args);
+        pthread_exit(NULL);
+    }
+
     // enter critical section
     int ret = sem_wait(critical_section);
     if(ret) {
@@ -117,7 +174,37 @@ void* thread_function(void* arg_ptr) {
     pthread_exit(NULL);
 }
 
-void parseOutput() {
+/*
+ * IO_SEGMENTS: appends the segments of the children to FILENAME, in child
+ * order, and removes them.
+ */
+void merge_segments() {
+    printf("[Main] Merging %d segments into %s...", n, FILENAME);
+    fflush(stdout);
+    int out = open(FILENAME, O_WRONLY | O_APPEND);
+    if (out < 0) handle_error("error while opening file");
+    int *buffer = malloc(SEGMENT_BATCH * sizeof(int));
+    char segment[64];
+    int i;
+    for (i = 0; i < n; i++) {
+        sprintf(segment, SEGMENT_NAME, i);
+        int in = open(segment, O_RDONLY);
+        if (in < 0) handle_error("error while opening segment");
+        ssize_t bytes;
+        while ((bytes = read(in, buffer, SEGMENT_BATCH * sizeof(int))) > 0) {
+            if (write(out, buffer, bytes) != bytes) handle_error("error while merging segment");
+        }
+        if (bytes < 0) handle_error("error while reading segment");
+        close(in);
+        if (unlink(segment)) handle_error("error while removing segment");
+    }
+    free(buffer);
+    close(out);
+    printf("done!!!\n");
+}
+
+// returns the number of records in the file
+int parseOutput() {
     // identify the child that accessed the file most times
     int* access_stats = calloc(n, sizeof(int)); // initialized with zeros
     printf("[Main] Opening file %s in read-only mode...", FILENAME);
@@ -140,8 +227,9 @@ void parseOutput() {
     close(fd);
     printf("closed!!!\n");
 
-    int max_child_id = -1, max_accesses = -1, i;
+    int max_child_id = -1, max_accesses = -1, i, total = 0;
     for (i = 0; i < n; i++) {
+        total += access_stats[i];
         printf("[Main] Child %d accessed file %s %d times\n", i, FILENAME, access_stats[i]);
         if (access_stats[i] > max_accesses) {
             max_accesses = access_stats[i];
@@ -150,6 +238,7 @@ void parseOutput() {
     }
     printf("[Main] ===> The process that accessed the file most often is %d (%d accesses)\n", max_child_id, max_accesses);
     free(access_stats);
+    return total;
 }
 
 void main_process() {
@@ -165,6 +254,8 @@ void main_process() {
     printf("[Main] All the children are now ready!!!\n");	
 
     // notify children to start their activities
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
     printf("[Main] Notifying children to start their activities...\n");
     for (i = 0; i < n; i++) {
         ret = sem_post(children_wait_for_main);
@@ -193,7 +284,7 @@ void main_process() {
     int child_status;
     for (i = 0; i < n; i++) {
         ret = wait(&child_status);
-		if(ret) {
+		if(ret == -1) {
 		    handle_error("wait failed");
 		}
         if (WEXITSTATUS(child_status)) {
@@ -203,8 +294,13 @@ void main_process() {
 	}
     printf("[Main] All the children have terminated!!!\n");
 
+    if (io_mode == IO_SEGMENTS) merge_segments();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
     // identify the child that accessed the file most times
-    parseOutput();
+    int records = parseOutput();
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("[Main] ===> %d records in %.2f s: %.0f records/s\n", records, seconds, records / seconds);
 
     // clean up
     printf("[Main] Cleaning up...");
@@ -240,14 +336,16 @@ void main_process() {
 	    handle_error("sem_unlink failed");
 	}
 
-    ret = sem_close(critical_section);
-	if(ret) {
-	    handle_error("sem_close failed");
+    if (io_mode == IO_SEMAPHORE) {
+        ret = sem_close(critical_section);
+        if(ret) {
+            handle_error("sem_close failed");
+        }
+        ret = sem_unlink(CRITICAL_SECTION);
+        if(ret) {
+            handle_error("sem_unlink failed");
+        }
     }
-    ret = sem_unlink(CRITICAL_SECTION);
-	if(ret) {
-	    handle_error("sem_unlink failed");
-	}
 
     printf("done!!!\n");
 }
@@ -274,18 +372,37 @@ void child_process(int child_id) {
     unsigned int thread_id = 0;
     pthread_t* thread_handlers = malloc(m * sizeof(pthread_t));
 
+    if (io_mode != IO_SEMAPHORE) {
+        // room for at least a round of threads
+        batch_capacity = (io_mode == IO_APPEND) ? PIPE_BUF / sizeof(int) : SEGMENT_BATCH;
+        if (batch_capacity < m) batch_capacity = m;
+        batch = malloc(batch_capacity * sizeof(int));
+        if (io_mode == IO_APPEND) {
+            log_fd = open(FILENAME, O_WRONLY | O_APPEND);
+        } else {
+            char segment[64];
+            sprintf(segment, SEGMENT_NAME, child_id);
+            log_fd = open(segment, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        }
+        if (log_fd < 0) handle_error("error while opening file");
+    }
+
     do {
         int j;
 
         // reuse the buffer across iterations
         memset(thread_handlers, 0, m * sizeof(pthread_t));
 
+        // write the batch if it has no room for the records of this round
+        if (io_mode != IO_SEMAPHORE && batch_count + m > batch_capacity) flush_batch(child_id);
+
         // create M threads
         printf("[Child#%d] Creating %d threads...\n", child_id, m);
         for (j = 0; j < m; j++) {
             thread_args_t *t_args = (thread_args_t *)malloc(sizeof(thread_args_t));
             t_args->child_id = child_id;
             t_args->thread_id = thread_id++;
+            t_args->slot = batch_count + j;
             ret = pthread_create(&thread_handlers[j], NULL, thread_function, t_args);
             if(ret) {
                 handle_error_en(ret, "pthread_create failed");
@@ -303,6 +420,7 @@ void child_process(int child_id) {
 			}
 		}
         printf("[Child#%d] %d threads completed!!!\n", child_id, m);
+        if (io_mode != IO_SEMAPHORE) batch_count += m;
 
         printf("[Child#%d] Checking for end activities notification...\n", child_id);
         ret = sem_getvalue(end_children_activities, &main_notification);
@@ -317,6 +435,12 @@ void child_process(int child_id) {
 
     free(thread_handlers);
 
+    if (io_mode != IO_SEMAPHORE) {
+        flush_batch(child_id);
+        close(log_fd);
+        free(batch);
+    }
+
     printf("[Child#%d] Activities completed!!!\n", child_id);
 
     // close our local handles to the named semaphores
@@ -335,10 +459,12 @@ void child_process(int child_id) {
 	    handle_error("sem_close failed");
     }
     
-    ret = sem_close(critical_section);
-	if(ret){
-	    handle_error("sem_close failed");
-	}
+    if (io_mode == IO_SEMAPHORE) {
+        ret = sem_close(critical_section);
+        if(ret){
+            handle_error("sem_close failed");
+        }
+    }
 }
 
 int main(int argc, char **argv) {
@@ -346,6 +472,15 @@ int main(int argc, char **argv) {
     if (argc > 1) n = atoi(argv[1]);
     if (argc > 2) m = atoi(argv[2]);
     if (argc > 3) t = atoi(argv[3]);
+    if (argc > 4) {
+        if (strcmp(argv[4], "semaphore") == 0) io_mode = IO_SEMAPHORE;
+        else if (strcmp(argv[4], "append") == 0) io_mode = IO_APPEND;
+        else if (strcmp(argv[4], "segments") == 0) io_mode = IO_SEGMENTS;
+        else {
+            fprintf(stderr, "Syntax: %s [N [M [T [semaphore|append|segments]]]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     int i;
 
@@ -358,8 +493,9 @@ int main(int argc, char **argv) {
     // children_wait_for_main named semaphore
     children_wait_for_main = create_named_semaphore(CHILDREN_WAIT_FOR_MAIN_SEMAPHORE_NAME, 0600, 0);
 
-    // critical section named semaphore
-    critical_section = create_named_semaphore(CRITICAL_SECTION, 0600, 1);
+    // critical section named semaphore, only needed by the threads of IO_SEMAPHORE
+    if (io_mode == IO_SEMAPHORE)
+        critical_section = create_named_semaphore(CRITICAL_SECTION, 0600, 1);
 
     // initialize the file
     init_file(FILENAME);